@@ -1,12 +1,137 @@
 #pragma once
 
-#include <map>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
-#include <boost/lockfree/queue.hpp>
+#include <boost/container/flat_map.hpp>
+#include <boost/container/small_vector.hpp>
 
 namespace decentralized_path_auction {
 
+// agent names are interned once into dense integer ids, where id 0 is reserved for the empty name
+class AgentId {
+public:
+    AgentId() = default;
+    AgentId(const std::string& name);
+    AgentId(const char* name)
+            : AgentId(std::string(name)) {}
+
+    const std::string& name() const;
+    uint32_t value() const { return _value; }
+    bool empty() const { return !_value; }
+
+    friend bool operator==(AgentId lhs, AgentId rhs) { return lhs._value == rhs._value; }
+    friend bool operator!=(AgentId lhs, AgentId rhs) { return lhs._value != rhs._value; }
+    friend bool operator<(AgentId lhs, AgentId rhs) { return lhs._value < rhs._value; }
+    friend std::ostream& operator<<(std::ostream& os, AgentId agent_id);
+
+private:
+    uint32_t _value = 0;
+};
+
+#ifdef DPA_PRICE_FRACTION_BITS
+// 64 bit fixed point price with DPA_PRICE_FRACTION_BITS fractional bits, so that comparisons and price gaps are exact
+// the highest price stands for an infinite price like FLT_MAX does for float prices, and sums saturate to it
+class Price {
+public:
+    constexpr Price() = default;
+    template <class T, std::enable_if_t<std::is_arithmetic_v<T>, int> = 0>
+    constexpr Price(T value)
+            : _raw(value >= FLT_MAX    ? INT64_MAX
+                    : value <= -FLT_MAX ? -INT64_MAX
+                                        : round(static_cast<double>(value) * ONE)) {}
+
+    static constexpr Price fromRaw(int64_t raw) {
+        Price price;
+        price._raw = raw;
+        return price;
+    }
+    constexpr int64_t raw() const { return _raw; }
+    explicit constexpr operator float() const {
+        return _raw == INT64_MAX ? FLT_MAX : _raw == -INT64_MAX ? -FLT_MAX : static_cast<float>(_raw / ONE);
+    }
+
+    friend constexpr Price operator+(Price lhs, Price rhs) {
+        if (lhs._raw == INT64_MAX || rhs._raw == INT64_MAX) {
+            return fromRaw(INT64_MAX);
+        }
+        if (lhs._raw == -INT64_MAX || rhs._raw == -INT64_MAX) {
+            return fromRaw(-INT64_MAX);
+        }
+        int64_t sum = 0;
+        if (__builtin_add_overflow(lhs._raw, rhs._raw, &sum) || sum == INT64_MIN) {
+            return fromRaw(lhs._raw < 0 ? -INT64_MAX : INT64_MAX);
+        }
+        return fromRaw(sum);
+    }
+    friend constexpr Price operator-(Price lhs, Price rhs) { return lhs + -rhs; }
+    friend constexpr Price operator-(Price price) { return fromRaw(-price._raw); }
+    friend constexpr Price operator*(Price lhs, int64_t rhs) {
+        int64_t product = 0;
+        if (lhs._raw == INT64_MAX || lhs._raw == -INT64_MAX || __builtin_mul_overflow(lhs._raw, rhs, &product) ||
+                product == INT64_MIN) {
+            return rhs ? fromRaw((lhs._raw < 0) != (rhs < 0) ? -INT64_MAX : INT64_MAX) : Price();
+        }
+        return fromRaw(product);
+    }
+    friend constexpr Price operator/(Price lhs, int64_t rhs) { return fromRaw(lhs._raw / rhs); }
+
+    constexpr Price& operator+=(Price rhs) { return *this = *this + rhs; }
+    constexpr Price& operator-=(Price rhs) { return *this = *this - rhs; }
+    constexpr Price& operator*=(int64_t rhs) { return *this = *this * rhs; }
+    constexpr Price& operator/=(int64_t rhs) { return *this = *this / rhs; }
+    // step by a whole unit like float prices do
+    constexpr Price& operator++() { return *this += 1; }
+    constexpr Price& operator--() { return *this -= 1; }
+
+    friend constexpr bool operator==(Price lhs, Price rhs) { return lhs._raw == rhs._raw; }
+    friend constexpr bool operator!=(Price lhs, Price rhs) { return lhs._raw != rhs._raw; }
+    friend constexpr bool operator<(Price lhs, Price rhs) { return lhs._raw < rhs._raw; }
+    friend constexpr bool operator>(Price lhs, Price rhs) { return lhs._raw > rhs._raw; }
+    friend constexpr bool operator<=(Price lhs, Price rhs) { return lhs._raw <= rhs._raw; }
+    friend constexpr bool operator>=(Price lhs, Price rhs) { return lhs._raw >= rhs._raw; }
+    friend std::ostream& operator<<(std::ostream& os, Price price);
+
+private:
+    static constexpr double ONE = static_cast<double>(int64_t(1) << DPA_PRICE_FRACTION_BITS);
+
+    // round finite prices to the nearest step below the infinite price
+    static constexpr int64_t round(double raw) {
+        return raw >= INT64_MAX    ? INT64_MAX - 1
+               : raw <= -INT64_MAX ? -INT64_MAX + 1
+                                   : static_cast<int64_t>(raw < 0 ? raw - 0.5 : raw + 0.5);
+    }
+
+    int64_t _raw = 0;
+};
+
+constexpr Price PRICE_MAX = Price::fromRaw(INT64_MAX);
+
+// lowest price above the given price
+constexpr Price nextPrice(Price price) {
+    return price == PRICE_MAX ? price : Price::fromRaw(price.raw() + 1);
+}
+#else
+using Price = float;
+
+constexpr Price PRICE_MAX = FLT_MAX;
+
+// lowest price above the given price
+inline Price nextPrice(Price price) {
+    return std::nextafter(price, FLT_MAX);
+}
+#endif
+
 class Auction {
 public:
     enum Error {
@@ -21,51 +146,181 @@ public:
     };
 
     struct Bid;
-    using Bids = std::map<float, Bid>;
+    class Context;
+    class Transaction;
+    class Mutex;
+    class ReadLock;
+    class WriteLock;
+    // bids are sorted by price in contiguous storage, each bid is allocated separately to keep links stable
+    using BidEntry = std::pair<Price, std::unique_ptr<Bid>>;
+    using Bids = boost::container::flat_map<Price, std::unique_ptr<Bid>, std::less<Price>,
+            boost::container::small_vector<BidEntry, 8>>;
 
-    Auction(float start_price = 0);
+    // auctions without a context share a process wide one
+    Auction(Price start_price = 0, std::shared_ptr<Context> context = nullptr);
     ~Auction();
 
     // non-copyable and non-movable
     Auction(const Auction&) = delete;
     Auction& operator=(const Auction&) = delete;
 
-    Error insertBid(const std::string& bidder, float price, float duration, Bid*& prev);
-    Error removeBid(const std::string& bidder, float price);
-    Error changeBid(float old_price, float new_price);
-    void clearBids(float start_price) { this->~Auction(), new (this) Auction(start_price); }
+    Error insertBid(AgentId bidder, Price price, float duration, Bid*& prev);
+    Error removeBid(AgentId bidder, Price price);
+    Error changeBid(Price old_price, Price new_price);
+    void clearBids(Price start_price) {
+        auto context = _context;
+        this->~Auction(), new (this) Auction(start_price, std::move(context));
+    }
 
     const Bids& getBids() const { return _bids; }
-    Bids::const_iterator getHigherBid(float price, const std::string& exclude_bidder = "") const;
-    Bids::const_iterator getHighestBid(const std::string& exclude_bidder = "") const;
+    const std::shared_ptr<Context>& getContext() const { return _context; }
+    // skips past the excluded bidder's bids by run length, or one by one while a transaction leaves bids unlinked
+    Bids::const_iterator getHigherBid(Price price, AgentId exclude_bidder = {}) const;
+    Bids::const_iterator getHighestBid(AgentId exclude_bidder = {}) const;
 
 private:
+    friend class BidOrder;
+    // order of a bid before it was changed within a transaction
+    struct Reorder {
+        Context* context;
+        Bid* bid;
+        std::pair<uint64_t, uint64_t> order;
+        bool unordered;
+    };
+
+    Error checkBid(AgentId bidder, Price price, float duration, const Bid* prev) const;
+    void linkBid(Bids::iterator it, Bid*& prev, std::vector<Reorder>* reorders = nullptr);
+
     Bids _bids;
+    std::shared_ptr<Context> _context;
+    // bids removed by an open transaction stay in place unlinked, which run lengths don't count
+    size_t _unlinked_count = 0;
 };
 
+// ids are recycled through per-thread free lists backed by a shared free list, most recently released first
 template <class T>
 class DenseId {
 public:
-    DenseId() {
-        if (!_free_ids.pop(_id)) {
-            _id = _count++;
-        }
-    }
-    ~DenseId() { _free_ids.push(_id); }
+    DenseId() { acquire(); }
+    ~DenseId() { release(); }
     // copy constructor is a hack to allow aggregate construction
     // but copies have different ID since they must be unique for every instance
     DenseId(const DenseId&)
             : DenseId() {}
     DenseId& operator=(const DenseId&) = delete;
 
+    // an instance may hand back its id while inactive and take a new one when reactivated
+    void acquire() {
+        if (_id != RELEASED) {
+            return;
+        }
+        auto cache = Cache::local();
+        if (!cache) {
+            // ids acquired during thread teardown are taken straight from the shared free list
+            Cache temp;
+            take(temp, 1);
+            _id = temp.ids.empty() ? _count++ : temp.ids.back();
+            return;
+        }
+        if (cache->ids.empty()) {
+            take(*cache, BATCH_SIZE);
+        }
+        if (cache->ids.empty()) {
+            _id = _count++;
+            return;
+        }
+        _id = cache->ids.back();
+        cache->ids.pop_back();
+    }
+    void release() {
+        if (_id == RELEASED) {
+            return;
+        }
+        if (auto cache = Cache::local()) {
+            cache->ids.push_back(_id);
+            // hand the least recently released ids back so threads that only release ids don't hoard them
+            if (cache->ids.size() > 2 * BATCH_SIZE) {
+                give(*cache, BATCH_SIZE);
+            }
+        } else {
+            Cache temp{{_id}};
+            give(temp, 1);
+        }
+        _id = RELEASED;
+    }
+
     operator size_t() const { return _id; }
     size_t operator()() const { return _id; }
     static size_t count() { return _count; }
 
+    // reclaim the highest free ids so that count() shrinks toward the number of live ids
+    // only ids released by the calling thread are reclaimed, ids cached by other threads stay reserved
+    static size_t compact() {
+        if (auto cache = Cache::local()) {
+            give(*cache, cache->ids.size());
+        }
+        auto& free_ids = FreeIds::instance();
+        std::lock_guard<std::mutex> lock(free_ids.mutex);
+        std::sort(free_ids.ids.begin(), free_ids.ids.end());
+        for (size_t count = _count; !free_ids.ids.empty() && free_ids.ids.back() + 1 == count; --count) {
+            // stop if an id was taken concurrently, since the count can only shrink from the top
+            if (!_count.compare_exchange_strong(count, free_ids.ids.back())) {
+                break;
+            }
+            free_ids.ids.pop_back();
+        }
+        // lowest ids are put on top, so they are reused first
+        std::reverse(free_ids.ids.begin(), free_ids.ids.end());
+        return _count;
+    }
+
 private:
-    size_t _id;
+    struct Cache {
+        std::vector<size_t> ids;
+
+        // returns null once the calling thread's cache has been destroyed
+        static Cache* local() {
+            thread_local bool retired = false;
+            struct Local : Cache {
+                ~Local() { give(*this, this->ids.size()), retired = true; }
+            };
+            thread_local Local cache;
+            return retired ? nullptr : &cache;
+        }
+    };
+
+    struct FreeIds {
+        std::mutex mutex;
+        std::vector<size_t> ids;
+
+        // intentionally leaked to outlive any static instances
+        static FreeIds& instance() {
+            static auto free_ids = new FreeIds;
+            return *free_ids;
+        }
+    };
+
+    // move the most recently given shared ids to the cache
+    static void take(Cache& cache, size_t count) {
+        auto& free_ids = FreeIds::instance();
+        std::lock_guard<std::mutex> lock(free_ids.mutex);
+        count = std::min(count, free_ids.ids.size());
+        cache.ids.insert(cache.ids.end(), free_ids.ids.end() - count, free_ids.ids.end());
+        free_ids.ids.resize(free_ids.ids.size() - count);
+    }
+
+    // move the least recently released cached ids to the shared list
+    static void give(Cache& cache, size_t count) {
+        auto& free_ids = FreeIds::instance();
+        std::lock_guard<std::mutex> lock(free_ids.mutex);
+        free_ids.ids.insert(free_ids.ids.end(), cache.ids.begin(), cache.ids.begin() + count);
+        cache.ids.erase(cache.ids.begin(), cache.ids.begin() + count);
+    }
+
+    static constexpr size_t RELEASED = SIZE_MAX;
+    static constexpr size_t BATCH_SIZE = 64;
+    size_t _id = RELEASED;
     static inline std::atomic<size_t> _count{0};
-    static inline boost::lockfree::queue<size_t> _free_ids{0};
 };
 
 struct CycleVisit {
@@ -74,7 +329,7 @@ struct CycleVisit {
 };
 
 struct Auction::Bid {
-    std::string bidder;
+    AgentId bidder;
     float duration = 0;
     // maintain unique id for every bid
     DenseId<Bid> id = {};
@@ -83,11 +338,167 @@ struct Auction::Bid {
     Bid* next = nullptr;
     Bid* lower = nullptr;
     Bid* higher = nullptr;
+    // context of the auction holding the bid, set once linked
+    Context* context = nullptr;
+    // number of consecutive lower and higher bids from the same bidder, used to skip past a bidder in constant time
+    uint32_t lower_run = 0;
+    uint32_t higher_run = 0;
+    // position in a topological order of all bids, where every bid is ordered before the bids it links to in time
+    // ranks are spaced apart so that new bids fit in between, serial numbers break ties
+    std::pair<uint64_t, uint64_t> order = {};
+    // set while a link to an earlier ordered bid remains, which only happens when links form a cycle
+    bool unordered = false;
+    // marks bids visited while reordering
+    bool reordering = false;
+
+    bool orderedBefore(const Bid& other) const { return order < other.order; }
 
+    // bids ordered after the last bid are skipped, since they can't reach any bid up to the last bid
+    // bids marked with the ancestor nonce count as marked ancestors in every call, so they only need marking once
+    bool detectCycle(std::vector<CycleVisit>& visits, size_t nonce, AgentId exclude_bidder = {},
+            const Bid* last = nullptr, size_t ancestor_nonce = 0) const;
     // recursive functions
-    bool detectCycle(std::vector<CycleVisit>& visits, size_t nonce, const std::string& exclude_bidder = "") const;
-    float waitDuration(const std::string& exclude_bidder = "") const;
+    float waitDuration(AgentId exclude_bidder = {}) const;
     const Auction::Bid& head() const { return prev ? prev->head() : *this; }
+
+    // bid storage is recycled through per-thread free lists backed by shared slabs
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr);
+};
+
+// bid order and link version shared by auctions whose bids may link to each other, such as all auctions of a graph
+// bids must only link to bids of auctions with the same context, which must all be written under the same lock
+class Auction::Context {
+public:
+    Context();
+
+    // non-copyable and non-movable
+    Context(const Context&) = delete;
+    Context& operator=(const Context&) = delete;
+
+    // the order is only reliable while no bids are unordered, since the bid graph may contain cycles otherwise
+    bool ordered() const { return !_unordered_count; }
+
+    // advanced whenever bids of the context are linked or unlinked, so that readers can tell whether any changed
+    // versions are drawn from a process wide sequence, so that no two contexts ever share the same version
+    size_t version() const { return _version; }
+    void advance();
+
+    // context of auctions created without one
+    static const std::shared_ptr<Context>& global();
+
+private:
+    friend class BidOrder;
+
+    std::atomic<size_t> _unordered_count{0};
+    std::atomic<uint64_t> _serial{0};
+    std::atomic<size_t> _version;
+};
+
+// stages bid changes across auctions so a batch can be committed or rolled back as a whole
+// removed bids are only unlinked until commit, and bids reinserted at the same price reuse them in place
+// unlinked bids hand back their ids so ids are assigned in the same order as with immediate removal
+// bids in any auction may be reordered by staged changes, so no auctions may be modified outside of the transaction
+// until it is committed or rolled back
+class Auction::Transaction {
+public:
+    Transaction() = default;
+    ~Transaction() { rollback(); }
+
+    // non-copyable and non-movable
+    Transaction(const Transaction&) = delete;
+    Transaction& operator=(const Transaction&) = delete;
+
+    Error insertBid(Auction& auction, AgentId bidder, Price price, float duration, Bid*& prev);
+    Error removeBid(Auction& auction, AgentId bidder, Price price);
+
+    void commit();
+    void rollback();
+
+private:
+    enum Type { INSERT, REUSE, REMOVE };
+    struct Change {
+        Type type;
+        Auction* auction;
+        Price price;
+        Bid* bid;
+        // bid state before the change
+        AgentId bidder = {};
+        float duration = 0;
+        Bid* prev = nullptr;
+        Bid* next = nullptr;
+        Bid* lower = nullptr;
+        Bid* higher = nullptr;
+    };
+    std::vector<Change> _changes;
+    std::vector<Reorder> _reorders;
+};
+
+// auctions are linked to each other through bids, so all auctions of a graph are read and written under one mutex
+// readers share access to the auctions, and readers that arrive after a waiting writer queue up behind it
+// every writer publishes a new version of the auctions, so readers can tell whether anything changed while unlocked
+class Auction::Mutex {
+public:
+    Mutex() = default;
+
+    // non-copyable and non-movable
+    Mutex(const Mutex&) = delete;
+    Mutex& operator=(const Mutex&) = delete;
+
+private:
+    friend class Auction::ReadLock;
+    friend class Auction::WriteLock;
+
+    std::shared_mutex _mutex;
+    // held by the writer next in line, so that readers arriving later queue up behind it
+    std::mutex _queue;
+    std::atomic<size_t> _waiting_writers{0};
+    std::atomic<size_t> _version{0};
+};
+
+// locks without a mutex don't lock anything, for auctions that are only accessed from one thread
+// locks are not recursive, a thread holding either lock on a mutex must not take another one on it
+class Auction::ReadLock {
+public:
+    ReadLock(Mutex* mutex)
+            : _mutex(mutex) {
+        lock();
+    }
+    ~ReadLock() { unlock(); }
+
+    // non-copyable and non-movable
+    ReadLock(const ReadLock&) = delete;
+    ReadLock& operator=(const ReadLock&) = delete;
+
+    void lock();
+    void unlock();
+    // briefly unlocks to let waiting writers go first, returns true if the auctions changed in the meantime
+    bool yield();
+
+    size_t version() const { return _version; }
+
+private:
+    Mutex* _mutex;
+    size_t _version = 0;
+    bool _locked = false;
+};
+
+class Auction::WriteLock {
+public:
+    WriteLock(Mutex* mutex);
+    ~WriteLock();
+
+    // non-copyable and non-movable
+    WriteLock(const WriteLock&) = delete;
+    WriteLock& operator=(const WriteLock&) = delete;
+
+private:
+    Mutex* _mutex;
 };
 
 }  // namespace decentralized_path_auction
+
+template <>
+struct std::hash<decentralized_path_auction::AgentId> {
+    size_t operator()(decentralized_path_auction::AgentId agent_id) const { return agent_id.value(); }
+};
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <unordered_map>
+#include <utility>
 #include <boost/geometry.hpp>
 #include <boost/geometry/geometries/point_xy.hpp>
 #include <boost/geometry/index/rtree.hpp>
@@ -31,59 +35,223 @@ using Nodes = std::vector<NodePtr>;
 
 struct Visit {
     NodePtr node;
-    float price = 0;
+    Price price = 0;
     float duration = 0;
-    float base_price = 0;
+    Price base_price = 0;
     float cost_estimate = 0;
     float time_estimate = 0;
 };
 
 using Path = std::vector<Visit>;
 
+using TravelTime = std::function<float(const NodePtr& prev, const NodePtr& cur, const NodePtr& next)>;
+
+// open addressing hash index of nodes by exact position, using linear probing with backward shift deletion
+class NodePositionIndex {
+public:
+    NodePositionIndex() = default;
+    NodePositionIndex(const NodePositionIndex&) = default;
+    NodePositionIndex(NodePositionIndex&& rhs)
+            : _slots(std::move(rhs._slots))
+            , _size(std::exchange(rhs._size, 0)) {}
+    NodePositionIndex& operator=(const NodePositionIndex&) = default;
+    NodePositionIndex& operator=(NodePositionIndex&& rhs) {
+        return _slots = std::move(rhs._slots), _size = std::exchange(rhs._size, 0), *this;
+    }
+
+    const NodePtr& find(const Point& position) const;
+    // returns false if the position is already taken
+    bool insert(const NodePtr& node);
+    bool remove(const NodePtr& node);
+    void reserve(size_t size);
+    void clear() { _slots.clear(), _size = 0; }
+    void swap(NodePositionIndex& rhs) { _slots.swap(rhs._slots), std::swap(_size, rhs._size); }
+    size_t size() const { return _size; }
+
+private:
+    struct Slot {
+        size_t hash = 0;
+        NodePtr node = nullptr;
+    };
+
+    // capacity is kept a power of two, so that slots are selected by masking the hash
+    size_t findSlot(const Point& position, size_t hash) const;
+
+    std::vector<Slot> _slots;
+    size_t _size = 0;
+};
+
 class NodeRTree {
 public:
     using RTreeNode = std::pair<Point, NodePtr>;
     using RTree = bg::index::rtree<RTreeNode, bg::index::rstar<16>>;
 
     bool insertNode(NodePtr node);
+    // inserts nodes in bulk and packs the whole tree again, which is faster than inserting nodes one by one
+    // invalid nodes and nodes with duplicate positions are skipped like insertNode, returns the number inserted
+    size_t insertNodes(Nodes nodes);
 
     // virtual to allow derived class to manage node ownership
     virtual bool removeNode(NodePtr node);
-    virtual void clearNodes() { _nodes.clear(); }
+    virtual void clearNodes() { _nodes.clear(), _index.clear(); }
 
+    // found nodes are referenced in place to avoid refcount changes, so copy them to keep them past modifications
     template <class Predicate>
-    NodePtr query(const Predicate& predicate) const {
+    const NodePtr& query(const Predicate& predicate) const {
+        static const NodePtr not_found = nullptr;
         auto q = _nodes.qbegin(predicate);
-        return q == _nodes.qend() ? nullptr : std::move(q->second);
+        return q == _nodes.qend() ? not_found : q->second;
     }
 
-    NodePtr findNode(Point position) const { return query(bg::index::contains(position)); }
-    NodePtr findNearestNode(Point position, Node::State criterion) const;
-    NodePtr findAnyNode(Node::State criterion) const;
+    // exact positions are looked up in a hash index, while the tree serves spatial queries
+    const NodePtr& findNode(Point position) const { return _index.find(position); }
+    const NodePtr& findNearestNode(Point position, Node::State criterion) const;
+    const NodePtr& findAnyNode(Node::State criterion) const;
 
     const RTree& getNodes() const { return _nodes; }
     bool containsNode(const NodePtr& node) const { return Node::validate(node) && (node == findNode(node->position)); }
 
 protected:
     RTree _nodes;
+    NodePositionIndex _index;
+};
+
+// adjacency of a graph frozen into compressed sparse row arrays of 32 bit node indices, for maps that stay static
+// edges to deleted nodes and loopback edges are dropped, and edges must not be modified while frozen
+// node states are still read from the nodes, so nodes may be disabled while frozen
+class CompactGraph {
+public:
+    using Index = uint32_t;
+    static constexpr Index NONE = UINT32_MAX;
+
+    // adjacent nodes of a node in the order of its edges
+    class Edges {
+    public:
+        class Iterator {
+        public:
+            Iterator(const Index* index, const NodePtr* nodes)
+                    : _index(index)
+                    , _nodes(nodes) {}
+            const NodePtr& operator*() const { return _nodes[*_index]; }
+            Index index() const { return *_index; }
+            Iterator& operator++() { return ++_index, *this; }
+            bool operator!=(const Iterator& rhs) const { return _index != rhs._index; }
+
+        private:
+            const Index* _index;
+            const NodePtr* _nodes;
+        };
+
+        Edges(const Index* begin, const Index* end, const NodePtr* nodes)
+                : _begin(begin)
+                , _end(end)
+                , _nodes(nodes) {}
+        Iterator begin() const { return {_begin, _nodes}; }
+        Iterator end() const { return {_end, _nodes}; }
+        size_t size() const { return _end - _begin; }
+
+    private:
+        const Index* _begin;
+        const Index* _end;
+        const NodePtr* _nodes;
+    };
+
+    // nodes reachable through edges from the graph are included as well
+    // travel times of every turn (prev, cur, next) across edges are cached when a travel time function is given
+    explicit CompactGraph(const NodeRTree& graph, TravelTime travel_time = nullptr);
+
+    size_t size() const { return _nodes.size(); }
+    Index findIndex(const Node* node) const;
+    const NodePtr& getNode(Index index) const { return _nodes[index]; }
+    Edges getEdges(Index index) const {
+        return {_edges.data() + _offsets[index], _edges.data() + _offsets[index + 1], _nodes.data()};
+    }
+    // nodes with an edge to the node at index, for searches running backwards
+    Edges getReverseEdges(Index index) const {
+        return {_reverse_edges.data() + _reverse_offsets[index], _reverse_edges.data() + _reverse_offsets[index + 1],
+                _nodes.data()};
+    }
+
+    // cached travel times from the node at index to each of its edges in order, coming from prev (null at source)
+    // returns null when travel times are not cached or prev is not adjacent to the node
+    const float* getTravelTimes(Index index, const Node* prev) const;
+    // recompute cached travel times of turns through a node after its state or custom data changed
+    // the state version is advanced as well, even without cached travel times, so that tables derived from node states
+    // are computed again
+    // must not be called while searches are reading the compact graph
+    void updateTravelTimes(const Node* node);
+    size_t getStateVersion() const { return _state_version; }
+
+private:
+    void cacheTravelTimes(Index index);
+
+    Nodes _nodes;
+    std::vector<Index> _offsets = {0};
+    std::vector<Index> _edges;
+    std::vector<Index> _reverse_offsets;
+    std::vector<Index> _reverse_edges;
+    TravelTime _travel_time;
+    std::vector<size_t> _turn_offsets;
+    std::vector<float> _travel_times;
+    std::unordered_map<const Node*, Index> _indices;
+    size_t _state_version = 0;
+};
+
+// travel times from and to a few landmark nodes spread across a compact graph, stored contiguously per node
+// lower bounds on travel time between any two nodes follow by triangle inequality, regardless of node states
+class Landmarks {
+public:
+    // landmarks are picked one by one as the node farthest from those picked before
+    Landmarks(std::shared_ptr<const CompactGraph> graph, size_t count, const TravelTime& travel_time);
+
+    const std::shared_ptr<const CompactGraph>& getGraph() const { return _graph; }
+    const std::vector<CompactGraph::Index>& getLandmarks() const { return _landmarks; }
+    float lowerBound(CompactGraph::Index from, CompactGraph::Index to) const;
+
+private:
+    void searchLandmark(size_t landmark, const TravelTime& travel_time, bool reverse);
+
+    std::shared_ptr<const CompactGraph> _graph;
+    std::vector<CompactGraph::Index> _landmarks;
+    std::vector<float> _from_landmarks;
+    std::vector<float> _to_landmarks;
 };
 
 class Graph : public NodeRTree {
 public:
     // non-copyable but movable (to force ownership of nodes to a single graph instance)
     ~Graph() { clearNodes(); }
-    Graph& operator=(Graph&& rhs) { return clearNodes(), _nodes.swap(rhs._nodes), *this; }
+    Graph& operator=(Graph&& rhs) {
+        clearNodes(), _nodes.swap(rhs._nodes), _index.swap(rhs._index);
+        return _auction_context.swap(rhs._auction_context), *this;
+    }
 
     void clearNodes() override;
     bool removeNode(NodePtr node) override;
     bool removeNode(Point position) { return removeNode(findNode(position)); }
 
+    // positions, states and edges are stored in a versioned binary file that is memory mapped when loaded
+    // loading replaces all current nodes, edges to nodes outside of the graph and custom data are not stored
+    bool save(const char* file) const;
+    bool load(const char* file);
+
+    // freeze current edges into a compact graph for searches, which must be frozen again after edges are modified
+    std::shared_ptr<CompactGraph> freeze(TravelTime travel_time = nullptr) const {
+        return std::make_shared<CompactGraph>(*this, std::move(travel_time));
+    }
+
+    // nodes created by the graph share its auction context, so that their bid order is kept apart from other graphs
+    // bids only link between nodes of the same context, so nodes inserted directly should use the graph's context
     using NodeRTree::insertNode;
-    template <class... Args>
-    NodePtr insertNode(Point position, Args&&... args) {
-        auto node = NodePtr(new Node{position, std::forward<Args>(args)...});
+    NodePtr insertNode(Point position, Node::State state = Node::DEFAULT) {
+        auto node = NodePtr(new Node{position, state, {}, {0, _auction_context}});
         return insertNode(node) ? std::move(node) : nullptr;
     }
+
+    const std::shared_ptr<Auction::Context>& getAuctionContext() const { return _auction_context; }
+
+private:
+    std::shared_ptr<Auction::Context> _auction_context = std::make_shared<Auction::Context>();
 };
 
 }  // namespace decentralized_path_auction
@@ -1,11 +1,54 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <typeindex>
 #include <decentralized_path_auction/graph.hpp>
 
 namespace decentralized_path_auction {
 
-class PathSearch {
+// precomputed travel times to destinations, shared between searches of agents with the same destinations
+// travel time models are told apart by the type of their callable, and by address for function pointers
+// models held by callables of the same type that differ only by their state must not share tables
+class CostEstimateTables {
+public:
+    struct Table {
+        std::shared_ptr<const CompactGraph> graph;
+        std::vector<float> travel_times;
+    };
+    using Compute = std::function<void(Table& table)>;
+    using Model = std::pair<std::type_index, uintptr_t>;
+
+    // tables are looked up by graph with its state version, travel time model and destinations with their states, so a
+    // table is computed again after node states were updated through the graph or destinations changed, and once no
+    // search holds it anymore
+    // a table is computed once outside the lock, while other searches asking for it wait on the result
+    std::shared_ptr<const Table> getTable(std::shared_ptr<const CompactGraph> graph, const NodeRTree& destinations,
+            const Model& model, const Compute& compute);
+    size_t size();
+
+private:
+    using Key = std::tuple<const CompactGraph*, size_t, Model, std::vector<std::pair<const Node*, Node::State>>>;
+    struct Entry {
+        std::weak_ptr<const Table> table;
+        std::shared_future<std::shared_ptr<const Table>> computing;
+    };
+
+    std::mutex _mutex;
+    std::map<Key, Entry> _tables;
+};
+
+// the travel time callable is a template parameter so that functors can be inlined into the search loop
+// member definitions are in path_search_impl.hpp, which only needs to be included for callables other than TravelTime
+template <class TravelTimeFn>
+class BasicPathSearch {
 public:
     enum Error {
         SUCCESS,
@@ -27,21 +70,39 @@ public:
         CONFIG_PRICE_INCREMENT_NON_POSITIVE,
         CONFIG_TIME_EXCHANGE_RATE_NON_POSITIVE,
         CONFIG_TRAVEL_TIME_MISSING,
+        CONFIG_COMPACT_GRAPH_MISSING,
     };
 
-    using TravelTime = std::function<float(const NodePtr& prev, const NodePtr& cur, const NodePtr& next)>;
+    using TravelTime = TravelTimeFn;
+    using Clock = std::chrono::steady_clock;
 
     struct Config {
-        std::string agent_id;
+        AgentId agent_id;
         float cost_limit = FLT_MAX;
         float price_increment = 1;
         float time_exchange_rate = 1;
-        TravelTime travel_time = travelDistance;
+        TravelTime travel_time = defaultTravelTime();
+        // adjacent nodes are read from the compact graph instead of node edges when the node is part of it
+        // travel times cached in the compact graph are used instead of travel_time for its edges
+        std::shared_ptr<const CompactGraph> compact_graph = nullptr;
+        // destinations are searched backwards through the compact graph for travel times that raise cost estimates
+        // travel times ignore turns, so they are exact only for travel time models that don't depend on the node before
+        bool precompute_cost_estimates = false;
+        // precomputed travel times are shared through the tables instead of being owned by the search
+        std::shared_ptr<CostEstimateTables> cost_estimate_tables = nullptr;
+        // estimates not precomputed are raised to lower bounds on travel time by landmarks of the graph
+        std::shared_ptr<const Landmarks> landmarks = nullptr;
+        // a path found before is returned as is while no bids were linked or unlinked and no node states around it
+        // changed since, and searched again in full otherwise
+        // changes to edges are not tracked
+        bool incremental_replanning = false;
+        // auctions are read under a lock on the mutex shared with the path sync that updates them from other threads
+        std::shared_ptr<Auction::Mutex> auction_mutex = nullptr;
 
         Error validate() const;
     };
 
-    PathSearch(Config config)
+    BasicPathSearch(Config config)
             : _config(std::move(config)) {}
 
     const Config& getConfig() const { return _config; }
@@ -51,30 +112,97 @@ public:
     Error setDestinations(Nodes destinations, float duration = FLT_MAX);
 
     Visit selectSource(const Nodes& sources);
-    Error iterate(Path& path, size_t iterations = 0);
-    Error iterate(Path& path, size_t iterations, float fallback_cost);
+    // the auction lock yields to writers on other threads between iterations
+    // once a writer changed the auctions, the search starts over on their changes with the iterations left
+    Error iterate(Path& path, size_t iterations = 0) { return iterate(path, Budget{iterations}); }
+    Error iterate(Path& path, size_t iterations, float fallback_cost) {
+        return iterate(path, Budget{iterations}, fallback_cost);
+    }
+    // iterations run until the deadline passes or stop gets set, after the first pass through the path
+    Error iterate(Path& path, Clock::time_point deadline, const std::atomic<bool>* stop = nullptr) {
+        return iterate(path, Budget{SIZE_MAX, deadline, stop});
+    }
+    Error iterate(
+            Path& path, Clock::time_point deadline, float fallback_cost, const std::atomic<bool>* stop = nullptr) {
+        return iterate(path, Budget{SIZE_MAX, deadline, stop}, fallback_cost);
+    }
+    // number of iterations that ran in the last call to iterate
+    size_t getIterationCount() const { return _iteration_count; }
+    // number of bids skipped in the last call to iterate without checking for cycles or waits, as they couldn't win
+    size_t getPrunedCount() const { return _pruned_count; }
     void resetCostEstimates() { ++_search_nonce; }
 
     static float travelDistance(const NodePtr&, const NodePtr& cur, const NodePtr& next) {
         return bg::distance(cur->position, next->position);
     }
 
+    // callables that can't hold travelDistance are default constructed
+    static TravelTime defaultTravelTime() {
+        if constexpr (std::is_constructible_v<TravelTime, decltype(&travelDistance)>) {
+            return TravelTime(travelDistance);
+        } else {
+            return TravelTime();
+        }
+    }
+
 private:
-    float getCostEstimate(const NodePtr& node, float base_price, const Auction::Bid& bid);
+    struct Budget {
+        size_t iterations;
+        Clock::time_point deadline = Clock::time_point::max();
+        const std::atomic<bool>* stop = nullptr;
+    };
+    // path found by the last search with the states of the nodes around it, to tell whether anything changed since
+    struct Snapshot {
+        size_t version = 0;
+        size_t search_nonce = 0;
+        float cost_limit = 0;
+        std::vector<std::tuple<const Node*, Price, Price>> visits;
+        std::vector<std::pair<NodePtr, Node::State>> nodes;
+    };
+
+    Error iterate(Path& path, Budget budget);
+    Error iterate(Path& path, Budget budget, float fallback_cost);
+    Error search(Path& path, Budget budget);
+    // returns nothing if writers changed the auctions during the search, so that it has to start over
+    std::optional<Error> search(Path& path, Budget& budget, Auction::ReadLock& lock);
+    void takeSnapshot(const Path& path);
+    bool checkSnapshot(const Path& path) const;
+    void precomputeCostEstimates();
+    void searchBackward(CostEstimateTables::Table& table) const;
+    float getCostEstimate(const NodePtr& node, Price base_price, const Auction::Bid& bid);
     float findMinCostVisit(Visit& min_cost_visit, const Visit& visit, const Visit& front_visit);
+    template <class Edges>
+    float findMinCostVisit(Visit& min_cost_visit, const Visit& visit, const Visit& front_visit, const Edges& edges,
+            const float* travel_times);
     bool appendMinCostVisit(size_t visit_index, Path& path);
     bool checkCostLimit(const Visit& visit) const;
     bool checkTermination(const Visit& visit) const;
-    bool detectCycle(const Auction::Bid& bid, const Visit& visit, const Visit& front_visit) const;
-    float determinePrice(float base_price, float price_limit, float cost, float alternative_cost) const;
+    // previous visits in path are marked as ancestors once per visit, on the first bid checked for cycles
+    struct CycleAncestors {
+        size_t nonce = 0;
+        const Auction::Bid* last = nullptr;
+    };
+    bool detectCycle(const Auction::Bid& bid, const Visit& visit, const Visit& front_visit,
+            CycleAncestors& ancestors) const;
+    Price determinePrice(Price base_price, Price price_limit, float cost, float alternative_cost) const;
 
     Config _config;
     NodeRTree _dst_nodes;
     float _dst_duration = FLT_MAX;
+    std::shared_ptr<const CostEstimateTables::Table> _dst_table;
+    std::shared_ptr<const Landmarks> _dst_landmarks;
+    std::vector<CompactGraph::Index> _dst_indices;
 
-    using BidKey = std::tuple<size_t, const Node*, float>;
+    using BidKey = std::tuple<size_t, const Node*, Price>;
     std::vector<std::pair<BidKey, float>> _cost_estimates, _fallback_cost_estimates;
     size_t _search_nonce = 1;
+    size_t _iteration_count = 0;
+    size_t _pruned_count = 0;
+
+    Snapshot _snapshot;
 };
 
+using PathSearch = BasicPathSearch<TravelTime>;
+extern template class BasicPathSearch<TravelTime>;
+
 }  // namespace decentralized_path_auction
@@ -0,0 +1,674 @@
+#pragma once
+
+#include <decentralized_path_auction/path_search.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <queue>
+
+#define DEBUG_PRINTF(...)  // printf(__VA_ARGS__)
+
+namespace decentralized_path_auction {
+
+inline const Auction::Bid& baseBid(const Visit& visit) {
+    return *visit.node->auction.getBids().find(visit.base_price)->second;
+}
+
+// travel time models are told apart by the type of their callable, looking through type erased functions
+template <class TravelTimeFn>
+CostEstimateTables::Model travelTimeModel(const TravelTimeFn&) {
+    return {typeid(TravelTimeFn), 0};
+}
+
+template <class R, class... Args>
+CostEstimateTables::Model travelTimeModel(R (*travel_time)(Args...)) {
+    return {typeid(travel_time), reinterpret_cast<uintptr_t>(travel_time)};
+}
+
+template <class R, class... Args>
+CostEstimateTables::Model travelTimeModel(const std::function<R(Args...)>& travel_time) {
+    auto function = travel_time.template target<R (*)(Args...)>();
+    return function ? travelTimeModel(*function) : CostEstimateTables::Model{travel_time.target_type(), 0};
+}
+
+template <class TravelTimeFn>
+auto BasicPathSearch<TravelTimeFn>::Config::validate() const -> Error {
+    if (agent_id.empty()) {
+        return CONFIG_AGENT_ID_EMPTY;
+    }
+    if (cost_limit <= 0) {
+        return CONFIG_COST_LIMIT_NON_POSITIVE;
+    }
+    if (price_increment <= 0) {
+        return CONFIG_PRICE_INCREMENT_NON_POSITIVE;
+    }
+    if (time_exchange_rate <= 0) {
+        return CONFIG_TIME_EXCHANGE_RATE_NON_POSITIVE;
+    }
+    if constexpr (std::is_constructible_v<bool, const TravelTimeFn&>) {
+        if (!travel_time) {
+            return CONFIG_TRAVEL_TIME_MISSING;
+        }
+    }
+    if (precompute_cost_estimates && !compact_graph) {
+        return CONFIG_COMPACT_GRAPH_MISSING;
+    }
+    return SUCCESS;
+}
+
+template <class TravelTimeFn>
+Visit BasicPathSearch<TravelTimeFn>::selectSource(const Nodes& sources) {
+    NodePtr min_node = nullptr;
+    Price base_price = PRICE_MAX;
+    float min_cost = FLT_MAX;
+    float alt_cost = FLT_MAX;
+    Auction::ReadLock lock(_config.auction_mutex.get());
+    // select node with lowest required bid and set price equal to second best alternative
+    for (auto& node : sources) {
+        if (!Node::validate(node)) {
+            continue;
+        }
+        auto& [bid_price, bid] = *node->auction.getHighestBid(_config.agent_id);
+        _cost_estimates.resize(std::max(_cost_estimates.size(), bid->id + 1));
+        float cost = static_cast<float>(bid_price) + getCostEstimate(node, bid_price, *bid);
+        if (cost < min_cost) {
+            min_node = node;
+            base_price = bid_price;
+            std::swap(cost, min_cost);
+        }
+        alt_cost = std::min(alt_cost, cost);
+    }
+    return {min_node, determinePrice(base_price, PRICE_MAX, min_cost, alt_cost), 0, base_price};
+}
+
+template <class TravelTimeFn>
+auto BasicPathSearch<TravelTimeFn>::setDestinations(Nodes destinations, float duration) -> Error {
+    if (duration < 0) {
+        return DESTINATION_DURATION_NEGATIVE;
+    }
+    _dst_duration = duration;
+    resetCostEstimates();
+    // reset destination nodes
+    _dst_nodes.clearNodes();
+    _dst_table = nullptr;
+    _dst_landmarks = nullptr;
+    _dst_indices.clear();
+    for (auto& node : destinations) {
+        // verify each destination node
+        if (!Node::validate(node)) {
+            return DESTINATION_NODE_INVALID;
+        }
+        if (node->state >= Node::NO_PARKING) {
+            return DESTINATION_NODE_NO_PARKING;
+        }
+        if (!_dst_nodes.insertNode(std::move(node))) {
+            return DESTINATION_NODE_DUPLICATED;
+        }
+    }
+    precomputeCostEstimates();
+    return SUCCESS;
+}
+
+template <class TravelTimeFn>
+auto BasicPathSearch<TravelTimeFn>::iterate(Path& path, Budget budget) -> Error {
+    _iteration_count = 0;
+    _pruned_count = 0;
+    return search(path, budget);
+}
+
+template <class TravelTimeFn>
+auto BasicPathSearch<TravelTimeFn>::search(Path& path, Budget budget) -> Error {
+    // check configs
+    if (Error config_error = _config.validate()) {
+        return config_error;
+    }
+    // check source node
+    if (path.empty()) {
+        return SOURCE_NODE_NOT_PROVIDED;
+    }
+    auto& src = path.front();
+    if (!Node::validate(src.node)) {
+        return SOURCE_NODE_INVALID;
+    }
+    if (src.node->state >= Node::DISABLED) {
+        return SOURCE_NODE_DISABLED;
+    }
+    Auction::ReadLock lock(_config.auction_mutex.get());
+    // the search starts over with the rest of the budget whenever writers changed the auctions while it yielded
+    for (;;) {
+        if (auto error = search(path, budget, lock)) {
+            return *error;
+        }
+    }
+}
+
+template <class TravelTimeFn>
+auto BasicPathSearch<TravelTimeFn>::search(Path& path, Budget& budget, Auction::ReadLock& lock)
+        -> std::optional<Error> {
+    auto& src = path.front();
+    // check destination nodes (empty means passive and any node will suffice)
+    if (!_dst_nodes.getNodes().empty() && !_dst_nodes.findAnyNode(Node::NO_FALLBACK)) {
+        return DESTINATION_NODE_NO_PARKING;
+    }
+    // the path found last time stands if nothing changed
+    if (checkSnapshot(path)) {
+        return SUCCESS;
+    }
+    _snapshot.version = 0;
+    // source visit is required to have the highest bid in auction to claim the source node
+    src.cost_estimate = 0;
+    src.time_estimate = 0;
+    src.base_price = src.node->auction.getHighestBid(_config.agent_id)->first;
+    if (src.base_price >= PRICE_MAX) {
+        return SOURCE_NODE_PRICE_INFINITE;
+    }
+    src.price = std::max(src.price, nextPrice(src.base_price)) + _config.price_increment;
+    // trivial solution
+    if (checkTermination(src)) {
+        src.duration = _dst_duration;
+        path.resize(1);
+        if (checkCostLimit(src)) {
+            return COST_LIMIT_EXCEEDED;
+        }
+        return takeSnapshot(path), SUCCESS;
+    }
+    // allocate cost lookup
+    _cost_estimates.resize(DenseId<Auction::Bid>::count());
+    size_t original_path_size = path.size();
+    // truncate visits in path that are invalid (node got deleted/disabled or bid got removed)
+    path.erase(std::find_if(path.begin() + 1, path.end(),
+                       [this](const Visit& visit) {
+                           return !Node::validate(visit.node) || visit.node->state >= Node::DISABLED ||
+                                  !visit.node->auction.getBids().count(visit.base_price) ||
+                                  visit.time_estimate < (&visit - 1)->time_estimate || checkTermination(visit);
+                       }),
+            path.end());
+    // iterate in reverse order through each visit in path on first pass
+    // use index to iterate since path will be modified at the end of each loop
+    for (int visit_index = path.size() - 1; visit_index >= 0; --visit_index) {
+        appendMinCostVisit(visit_index, path);
+    }
+    if (checkCostLimit(path.front())) {
+        return COST_LIMIT_EXCEEDED;
+    }
+    if (checkTermination(path.back())) {
+        return takeSnapshot(path), SUCCESS;
+    }
+    if (budget.iterations == 0) {
+        return path.size() > original_path_size ? PATH_EXTENDED : PATH_CONTRACTED;
+    }
+    // run through requested iterations
+    for (size_t visit_index = path.size() - 1; budget.iterations--; --visit_index) {
+        DEBUG_PRINTF("IDX %lu ITT %lu\r\n", visit_index, budget.iterations);
+        // let writers on other threads go first, and start over on their changes with iterations left to run
+        // the iteration counts as used, so that a steady stream of writers can't keep the search from returning
+        if (budget.iterations && lock.yield()) {
+            ++_iteration_count;
+            return std::nullopt;
+        }
+        // the path found so far is kept once time is up
+        if ((budget.stop && budget.stop->load(std::memory_order_relaxed)) ||
+                (budget.deadline != Clock::time_point::max() && Clock::now() >= budget.deadline)) {
+            return ITERATIONS_REACHED;
+        }
+        ++_iteration_count;
+        // check previous visit if cost increased otherwise start again from last visit
+        if (!appendMinCostVisit(visit_index, path) || visit_index == 0) {
+            if (checkCostLimit(path.front())) {
+                return COST_LIMIT_EXCEEDED;
+            }
+            if (checkTermination(path.back())) {
+                return takeSnapshot(path), SUCCESS;
+            }
+            visit_index = path.size();
+        }
+    }
+    return ITERATIONS_REACHED;
+}
+
+template <class TravelTimeFn>
+void BasicPathSearch<TravelTimeFn>::takeSnapshot(const Path& path) {
+    if (!_config.incremental_replanning || _dst_nodes.getNodes().empty() || path.empty()) {
+        return;
+    }
+    _snapshot.version = path.front().node->auction.getContext()->version();
+    _snapshot.search_nonce = _search_nonce;
+    _snapshot.cost_limit = _config.cost_limit;
+    _snapshot.visits.clear();
+    _snapshot.nodes.clear();
+    auto watch_edges = [this](const auto& edges) {
+        for (auto& node : edges) {
+            if (node) {
+                _snapshot.nodes.emplace_back(node, node->state);
+            }
+        }
+    };
+    // each visit depends on the states of its own node and the adjacent nodes it chooses from
+    for (auto& visit : path) {
+        _snapshot.visits.emplace_back(visit.node.get(), visit.base_price, visit.price);
+        _snapshot.nodes.emplace_back(visit.node, visit.node->state);
+        auto& compact_graph = _config.compact_graph;
+        auto index = compact_graph ? compact_graph->findIndex(visit.node.get()) : CompactGraph::NONE;
+        if (index != CompactGraph::NONE) {
+            watch_edges(compact_graph->getEdges(index));
+        } else {
+            watch_edges(visit.node->edges);
+        }
+    }
+}
+
+template <class TravelTimeFn>
+bool BasicPathSearch<TravelTimeFn>::checkSnapshot(const Path& path) const {
+    // snapshots only apply to the same path searched for the same destinations and cost limit
+    if (!_config.incremental_replanning || _dst_nodes.getNodes().empty() || !_snapshot.version ||
+            _snapshot.search_nonce != _search_nonce || _snapshot.cost_limit != _config.cost_limit ||
+            _snapshot.visits.size() != path.size()) {
+        return false;
+    }
+    // wait durations and cycles of bids around the path depend on bids anywhere along their links
+    if (path.front().node->auction.getContext()->version() != _snapshot.version) {
+        return false;
+    }
+    for (size_t visit_index = 0; visit_index < path.size(); ++visit_index) {
+        auto& visit = path[visit_index];
+        if (_snapshot.visits[visit_index] != std::make_tuple(visit.node.get(), visit.base_price, visit.price)) {
+            return false;
+        }
+    }
+    return std::all_of(_snapshot.nodes.begin(), _snapshot.nodes.end(),
+            [](auto& node) { return node.first->state == node.second; });
+}
+
+template <class TravelTimeFn>
+auto BasicPathSearch<TravelTimeFn>::iterate(Path& path, Budget budget, float fallback_cost) -> Error {
+    _iteration_count = 0;
+    _pruned_count = 0;
+    // query for path with cost limit set to fallback cost
+    fallback_cost = std::min(fallback_cost, _config.cost_limit);
+    std::swap(fallback_cost, _config.cost_limit);
+    auto error = search(path, budget);
+    std::swap(fallback_cost, _config.cost_limit);
+    // return if success or search input check failed or destination was empty/passive
+    if (error == SUCCESS || error > ITERATIONS_REACHED || _dst_nodes.getNodes().empty()) {
+        return error;
+    }
+    // calculate fallback path by swapping out destination and cost estimates
+    // the seperate fallback cache allows the original search to be resumed without cost reset
+    path.resize(1);
+    auto dst_nodes = std::move(_dst_nodes);
+    assert(_dst_nodes.getNodes().empty());
+    _cost_estimates.swap(_fallback_cost_estimates);
+    auto fallback_error = search(path, budget);
+    _dst_nodes = std::move(dst_nodes);
+    _cost_estimates.swap(_fallback_cost_estimates);
+    // divert to fallback if requested path failed or has higher cost than fallback
+    if (fallback_error == SUCCESS) {
+        return FALLBACK_DIVERTED;
+    }
+    // stay if one place if both requested and fallback paths fail
+    path.resize(1);
+    path.front().price = PRICE_MAX;
+    path.front().duration = FLT_MAX;
+    return error;
+}
+
+template <class TravelTimeFn>
+void BasicPathSearch<TravelTimeFn>::precomputeCostEstimates() {
+    // passive searches have no destinations to estimate costs for
+    if (_dst_nodes.getNodes().empty() || _config.validate()) {
+        return;
+    }
+    // destinations are looked up in the graph of the landmarks once for all estimates
+    if ((_dst_landmarks = _config.landmarks)) {
+        for (auto& rt_node : _dst_nodes.getNodes()) {
+            auto index = _dst_landmarks->getGraph()->findIndex(rt_node.second.get());
+            if (index != CompactGraph::NONE && rt_node.second->state <= Node::NO_FALLBACK) {
+                _dst_indices.push_back(index);
+            }
+        }
+    }
+    if (!_config.precompute_cost_estimates || !_config.compact_graph) {
+        return;
+    }
+    if (auto& tables = _config.cost_estimate_tables) {
+        _dst_table = tables->getTable(_config.compact_graph, _dst_nodes, travelTimeModel(_config.travel_time),
+                [this](CostEstimateTables::Table& table) { searchBackward(table); });
+        return;
+    }
+    auto table = std::make_shared<CostEstimateTables::Table>();
+    table->graph = _config.compact_graph;
+    searchBackward(*table);
+    _dst_table = std::move(table);
+}
+
+template <class TravelTimeFn>
+void BasicPathSearch<TravelTimeFn>::searchBackward(CostEstimateTables::Table& table) const {
+    auto& graph = *table.graph;
+    auto& travel_times = table.travel_times;
+    travel_times.assign(graph.size(), FLT_MAX);
+    // dijkstra from all destinations along reverse edges, without regard for auctions
+    // travel times are taken without the node before, so they are exact only for models that don't depend on turns
+    using QueueEntry = std::pair<float, CompactGraph::Index>;
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry>> queue;
+    for (auto& rt_node : _dst_nodes.getNodes()) {
+        auto index = graph.findIndex(rt_node.second.get());
+        if (index != CompactGraph::NONE && rt_node.second->state <= Node::NO_FALLBACK) {
+            travel_times[index] = 0;
+            queue.push({0, index});
+        }
+    }
+    while (!queue.empty()) {
+        auto [travel_time, index] = queue.top();
+        queue.pop();
+        if (travel_time > travel_times[index]) {
+            continue;
+        }
+        auto& node = graph.getNode(index);
+        auto prev_nodes = graph.getReverseEdges(index);
+        for (auto prev_node = prev_nodes.begin(); prev_node != prev_nodes.end(); ++prev_node) {
+            // disabled nodes are avoided as they were when destinations got set
+            if ((*prev_node)->state >= Node::DISABLED) {
+                continue;
+            }
+            float prev_travel_time = travel_time + _config.travel_time(nullptr, *prev_node, node);
+            if (prev_travel_time < travel_times[prev_node.index()]) {
+                travel_times[prev_node.index()] = prev_travel_time;
+                queue.push({prev_travel_time, prev_node.index()});
+            }
+        }
+    }
+}
+
+template <class TravelTimeFn>
+float BasicPathSearch<TravelTimeFn>::getCostEstimate(const NodePtr& node, Price base_price, const Auction::Bid& bid) {
+    auto& [key, cost_estimate] = _cost_estimates[bid.id];
+    BidKey new_key = {_search_nonce, node.get(), base_price};
+    if (key != new_key) {
+        key = new_key;
+        // initialize cost proportional to travel time from node to destination
+        if (_dst_nodes.getNodes().empty()) {
+            cost_estimate = 0;
+        } else {
+            assert(Node::validate(node));
+            auto& nearest_goal = _dst_nodes.findNearestNode(node->position, Node::NO_FALLBACK);
+            float travel_time = _config.travel_time(nullptr, node, nearest_goal);
+            // landmarks raise the estimate to a lower bound of travel time through the graph
+            auto index = _dst_landmarks ? _dst_landmarks->getGraph()->findIndex(node.get()) : CompactGraph::NONE;
+            if (index != CompactGraph::NONE) {
+                float lower_bound = FLT_MAX;
+                for (auto dst_index : _dst_indices) {
+                    lower_bound = std::min(lower_bound, _dst_landmarks->lowerBound(index, dst_index));
+                }
+                travel_time = lower_bound < FLT_MAX ? std::max(travel_time, lower_bound) : travel_time;
+            }
+            // precomputed travel times ignore turns, so they only raise the estimate like a bound
+            // nodes not reached by the backward search keep the estimate
+            if (_dst_table) {
+                auto dst_index = _dst_table->graph->findIndex(node.get());
+                if (dst_index != CompactGraph::NONE && _dst_table->travel_times[dst_index] < FLT_MAX) {
+                    travel_time = std::max(travel_time, _dst_table->travel_times[dst_index]);
+                }
+            }
+            cost_estimate = travel_time * _config.time_exchange_rate;
+        }
+    }
+    return cost_estimate;
+}
+
+template <class TravelTimeFn>
+float BasicPathSearch<TravelTimeFn>::findMinCostVisit(
+        Visit& min_cost_visit, const Visit& visit, const Visit& front_visit) {
+    if (auto& compact_graph = _config.compact_graph) {
+        auto index = compact_graph->findIndex(visit.node.get());
+        if (index != CompactGraph::NONE) {
+            auto prev_node = &visit == &front_visit ? nullptr : (&visit - 1)->node.get();
+            auto travel_times = compact_graph->getTravelTimes(index, prev_node);
+            return findMinCostVisit(min_cost_visit, visit, front_visit, compact_graph->getEdges(index), travel_times);
+        }
+    }
+    return findMinCostVisit(min_cost_visit, visit, front_visit, visit.node->edges, nullptr);
+}
+
+template <class TravelTimeFn>
+template <class Edges>
+float BasicPathSearch<TravelTimeFn>::findMinCostVisit(Visit& min_cost_visit, const Visit& visit,
+        const Visit& front_visit, const Edges& edges, const float* travel_times) {
+    const NodePtr& prev_node = &visit == &front_visit ? nullptr : (&visit - 1)->node;
+    float backtrack_cost = FLT_MAX;
+    float min_cost = FLT_MAX;
+    float alt_cost = FLT_MAX;
+    const NodePtr* min_node = nullptr;
+    CycleAncestors ancestors;
+    min_cost_visit = {};
+    // loop over each adjacent node
+    size_t edge_index = 0;
+    for (const auto& adj_node : edges) {
+        size_t edge = edge_index++;
+        DEBUG_PRINTF("->[%f %f] \r\n", adj_node->position.get<0>(), adj_node->position.get<1>());
+        // skip loopback nodes
+        if (adj_node == visit.node) {
+            DEBUG_PRINTF("Node Loopback\r\n");
+            continue;
+        }
+        // skip deleted and disabled nodes
+        if (!adj_node || adj_node->state >= Node::DISABLED) {
+            DEBUG_PRINTF("Node Disabled\r\n");
+            continue;
+        }
+        // calculate the expected time to arrive at the adjacent node (without wait)
+        float travel_time = travel_times ? travel_times[edge] : _config.travel_time(prev_node, visit.node, adj_node);
+        float earliest_arrival_time = visit.time_estimate + travel_time;
+        assert(travel_time > 0 && "travel time must be positive");
+        // iterate in reverse order (highest to lowest) through each bid in the auction of the adjacent node
+        auto& adj_bids = adj_node->auction.getBids();
+        auto higher_bid = adj_bids.begin();
+        for (auto& [bid_price, bid] : adj_bids) {
+            ++higher_bid;
+            DEBUG_PRINTF("    ID %lu Base %f ", bid->id(), static_cast<float>(bid_price));
+            // skip bids that belong to this agent
+            if (bid->bidder == _config.agent_id) {
+                DEBUG_PRINTF("Skipped Self\r\n");
+                continue;
+            }
+            // skip if price is infinite
+            if (bid_price >= PRICE_MAX) {
+                DEBUG_PRINTF("Infinite Price\r\n");
+                continue;
+            }
+            // skip if there is no price gap between base bid and next higher bid
+            if (higher_bid != adj_bids.end() && higher_bid->second->bidder != _config.agent_id) {
+                Price mid_price = bid_price + (higher_bid->first - bid_price) / 2;
+                if (mid_price == bid_price || mid_price == higher_bid->first) {
+                    DEBUG_PRINTF("No Price Gap\r\n");
+                    continue;
+                }
+            }
+            // skip if bid came from previous visit
+            float adj_cost = getCostEstimate(adj_node, bid_price, *bid);
+            if (prev_node == adj_node && (&visit - 1)->base_price == bid_price) {
+                backtrack_cost = (travel_time * _config.time_exchange_rate) + static_cast<float>(bid_price) + adj_cost;
+                DEBUG_PRINTF("Backtrack Cost %f\r\n", backtrack_cost);
+                continue;
+            }
+            // skip the bid if even arriving without wait can't beat the second best cost, before the costly checks
+            float min_time_cost = (earliest_arrival_time - visit.time_estimate) * _config.time_exchange_rate;
+            if (min_time_cost + static_cast<float>(bid_price) + adj_cost >= alt_cost) {
+                DEBUG_PRINTF("Cost Bound Pruned\r\n");
+                ++_pruned_count;
+                continue;
+            }
+            // skip the bid if it causes cyclic dependencies
+            if (detectCycle(*bid, visit, front_visit, ancestors)) {
+                DEBUG_PRINTF("Cycle Detected\r\n");
+                continue;
+            }
+            // skip bid if it requires waiting but current node doesn't allow it
+            float wait_duration = higher_bid == adj_bids.end() ? 0 : higher_bid->second->waitDuration(_config.agent_id);
+            if (visit.node->state == Node::NO_STOPPING && wait_duration > earliest_arrival_time) {
+                DEBUG_PRINTF("No Stopping\r\n");
+                continue;
+            }
+            // arrival_time factors in how long you have to wait
+            float arrival_time = std::max(wait_duration, earliest_arrival_time);
+            // time cost is proportinal to duration between arrival and departure
+            float time_cost = (arrival_time - visit.time_estimate) * _config.time_exchange_rate;
+            assert(time_cost >= 0);
+            // total cost of visit aggregates time cost, price of bid, and estimated cost from adj node to dst
+            float cost_estimate = time_cost + static_cast<float>(bid_price) + adj_cost;
+            DEBUG_PRINTF("Cost %f\r\n", cost_estimate);
+            // keep track of lowest cost visit found, the node is only copied into the visit once found
+            if (cost_estimate < min_cost) {
+                std::swap(cost_estimate, min_cost);
+                min_node = &adj_node;
+                min_cost_visit.duration = travel_time;
+                min_cost_visit.base_price = bid_price;
+                min_cost_visit.cost_estimate = adj_cost;
+                min_cost_visit.time_estimate = arrival_time;
+            }
+            // keep track of second best cost
+            alt_cost = std::min(cost_estimate, alt_cost);
+        }
+    }
+    if (backtrack_cost < min_cost) {
+        min_cost_visit = {};
+        return backtrack_cost;
+    }
+    // decide on a bid price for the min cost visit
+    if (min_node) {
+        min_cost_visit.node = *min_node;
+        auto higher_bid = min_cost_visit.node->auction.getHigherBid(min_cost_visit.base_price, _config.agent_id);
+        Price higher_price = higher_bid == min_cost_visit.node->auction.getBids().end() ? PRICE_MAX : higher_bid->first;
+        min_cost_visit.price = determinePrice(min_cost_visit.base_price, higher_price, min_cost, alt_cost);
+        assert(min_cost_visit.price > min_cost_visit.base_price);
+        assert(min_cost_visit.price < higher_price);
+    }
+    return min_cost;
+}
+
+template <class TravelTimeFn>
+bool BasicPathSearch<TravelTimeFn>::appendMinCostVisit(size_t visit_index, Path& path) {
+    assert(visit_index < path.size());
+    auto& visit = path[visit_index];
+    DEBUG_PRINTF("[%f %f] ID %lu Base %f\r\n", visit.node->position.get<0>(), visit.node->position.get<1>(),
+            baseBid(visit).id(), static_cast<float>(visit.base_price));
+    // find min cost visit
+    Visit min_cost_visit;
+    float min_cost = findMinCostVisit(min_cost_visit, visit, path.front());
+    // update cost estimate of current visit to the min cost of all adjacent visits
+    auto& [cost_key, cost_estimate] = _cost_estimates[baseBid(visit).id];
+    bool cost_increased = min_cost > cost_estimate;
+    DEBUG_PRINTF("Min ID %lu Base %f Cost %f Prev %f\r\n\r\n", min_cost_visit.node ? baseBid(min_cost_visit).id() : -1,
+            static_cast<float>(min_cost_visit.base_price), min_cost, cost_estimate);
+    visit.duration = min_cost_visit.duration;
+    visit.cost_estimate = min_cost;
+    cost_estimate = min_cost;
+    cost_key = {_search_nonce, visit.node.get(), visit.base_price};
+    if (!min_cost_visit.node) {
+        // truncate rest of path if min cost visit is a dead end
+        path.resize(visit_index + 1);
+    } else if (&visit == &path.back()) {
+        // append min cost visit if already at the back of path
+        path.push_back(std::move(min_cost_visit));
+    } else {
+        // truncate path if min cost visit is different from next visit in path
+        auto& next_visit = path[visit_index + 1];
+        if (next_visit.node != min_cost_visit.node || next_visit.base_price != min_cost_visit.base_price) {
+            path.resize(visit_index + 2);
+        }
+        min_cost_visit.duration = next_visit.duration;
+        next_visit = std::move(min_cost_visit);
+    }
+    path.back().duration = _dst_duration;
+    // WARNING: visit ref variable is invalidated at this point after modifying path vector
+    return cost_increased;
+}
+
+template <class TravelTimeFn>
+bool BasicPathSearch<TravelTimeFn>::checkCostLimit(const Visit& visit) const {
+    return static_cast<float>(visit.base_price) + visit.cost_estimate > _config.cost_limit;
+}
+
+template <class TravelTimeFn>
+bool BasicPathSearch<TravelTimeFn>::checkTermination(const Visit& visit) const {
+    // termination condition for passive paths (any parkable node where there are no lower bids)
+    return (_dst_nodes.getNodes().empty() && visit.node->state < Node::NO_FALLBACK &&
+                   visit.base_price == visit.node->auction.getBids().begin()->first) ||
+           // termination condition for regular destinations
+           _dst_nodes.containsNode(visit.node);
+}
+
+template <class TravelTimeFn>
+bool BasicPathSearch<TravelTimeFn>::detectCycle(const Auction::Bid& bid, const Visit& visit, const Visit& front_visit,
+        CycleAncestors& ancestors) const {
+    thread_local size_t cycle_nonce = 0;
+    thread_local std::vector<CycleVisit> cycle_visits;
+    // mark previous visits in path as part of ancestor visits with a nonce that stays valid for the other bids
+    if (!ancestors.nonce) {
+        cycle_visits.resize(_cost_estimates.size());
+        ancestors.nonce = ++cycle_nonce;
+        for (const Visit* visit_ptr = &front_visit; visit_ptr != &visit; ++visit_ptr) {
+            auto& ancestor_bid = baseBid(*visit_ptr);
+            cycle_visits[ancestor_bid.id] = {ancestors.nonce, 2};
+            if (!ancestors.last || ancestors.last->orderedBefore(ancestor_bid)) {
+                ancestors.last = &ancestor_bid;
+            }
+        }
+    }
+    size_t nonce = ++cycle_nonce;
+    // cycles can only pass through bids ordered up to the last marked bid
+    auto& base_bid = baseBid(visit);
+    auto last = base_bid.orderedBefore(bid) ? &bid : &base_bid;
+    if (ancestors.last && last->orderedBefore(*ancestors.last)) {
+        last = ancestors.last;
+    }
+    if (!visit.node->auction.getContext()->ordered()) {
+        last = nullptr;
+    }
+    // ancestor marks of bids that get marked for this bid only are restored afterwards
+    auto bid_mark = cycle_visits[bid.id];
+    auto base_mark = cycle_visits[base_bid.id];
+    auto restore = [&](bool cycle) {
+        if (base_mark.nonce == ancestors.nonce) {
+            cycle_visits[base_bid.id] = base_mark;
+        }
+        if (bid_mark.nonce == ancestors.nonce) {
+            cycle_visits[bid.id] = bid_mark;
+        }
+        return cycle;
+    };
+    // detect cycle of prev->lower bid
+    cycle_visits[bid.id] = {nonce, 2};
+    if (base_bid.detectCycle(cycle_visits, nonce, _config.agent_id, last, ancestors.nonce)) {
+        return restore(true);
+    }
+    // detect cycle of lower bid
+    cycle_visits[base_bid.id].in_cycle = 2;
+    cycle_visits[bid.id].nonce = 0;
+    return restore(bid.detectCycle(cycle_visits, nonce, _config.agent_id, last, ancestors.nonce));
+}
+
+template <class TravelTimeFn>
+Price BasicPathSearch<TravelTimeFn>::determinePrice(
+        Price base_price, Price price_limit, float cost, float alternative_cost) const {
+    assert(cost <= alternative_cost);
+    assert(base_price < price_limit);
+    base_price = nextPrice(base_price);
+    // just raise by price increment if alternative doesn't exist
+    Price min_price = base_price + _config.price_increment;
+    if (alternative_cost >= FLT_MAX && price_limit >= PRICE_MAX) {
+        return min_price;
+    }
+    // take mid price if it is lower than minimum increment to avoid bidding over slot limit
+    Price mid_price = base_price + (price_limit - base_price) / 2;
+    if (mid_price <= min_price) {
+        return mid_price;
+    }
+    // willing to pay additionally up to the surplus benefit compared to best alternative
+    Price price = base_price + alternative_cost - cost;
+    Price three_quarter_price = mid_price + (price_limit - mid_price) / 2;
+    return std::clamp(price, min_price, three_quarter_price);
+}
+
+}  // namespace decentralized_path_auction
+
+#undef DEBUG_PRINTF
@@ -44,20 +44,29 @@ public:
         float remaining_duration;
     };
 
-    using Paths = std::unordered_map<std::string, PathInfo>;
+    using Paths = std::unordered_map<AgentId, PathInfo>;
+
+    // paths are updated under a write lock on the auction mutex, which searches on other threads share to read the
+    // auctions concurrently, paths synced without a mutex must not be searched or updated from other threads
+    PathSync(std::shared_ptr<Auction::Mutex> auction_mutex = nullptr)
+            : _auction_mutex(std::move(auction_mutex)) {}
 
     // non-copyable but movable
     ~PathSync() { clearPaths(); }
-    PathSync& operator=(PathSync&& rhs) { return clearPaths(), _paths.swap(rhs._paths), *this; }
+    PathSync& operator=(PathSync&& rhs) {
+        return clearPaths(), _paths.swap(rhs._paths), _auction_mutex.swap(rhs._auction_mutex), *this;
+    }
+
+    const std::shared_ptr<Auction::Mutex>& getAuctionMutex() const { return _auction_mutex; }
 
-    Error updatePath(const std::string& agent_id, const Path& path, size_t path_id);
-    Error updateProgress(const std::string& agent_id, size_t progress_min, size_t progress_max, size_t path_id);
+    Error updatePath(AgentId agent_id, const Path& path, size_t path_id);
+    Error updateProgress(AgentId agent_id, size_t progress_min, size_t progress_max, size_t path_id);
 
     // remove all bids from auction when path is removed
-    Error removePath(const std::string& agent_id);
+    Error removePath(AgentId agent_id);
     Error clearPaths();
 
-    WaitStatus checkWaitStatus(const std::string& agent_id) const;
+    WaitStatus checkWaitStatus(AgentId agent_id) const;
 
     const Paths& getPaths() const { return _paths; }
 
@@ -66,6 +75,7 @@ public:
 
 private:
     Paths _paths;
+    std::shared_ptr<Auction::Mutex> _auction_mutex;
 };
 
 }  // namespace decentralized_path_auction
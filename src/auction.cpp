@@ -1,22 +1,482 @@
 #include <decentralized_path_auction/auction.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <unordered_map>
+
 namespace decentralized_path_auction {
 
-Auction::Auction(float start_price)
-        : _bids({{start_price, {""}}}) {}
+struct AgentRegistry {
+    std::mutex mutex;
+    // names are never removed and deque elements don't move, so ids and views stay valid
+    std::deque<std::string> names = {""};
+    std::unordered_map<std::string_view, uint32_t> ids;
+
+    static AgentRegistry& instance() {
+        static AgentRegistry registry;
+        return registry;
+    }
+};
+
+AgentId::AgentId(const std::string& name) {
+    if (name.empty()) {
+        return;
+    }
+    auto& registry = AgentRegistry::instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    if (auto found = registry.ids.find(name); found != registry.ids.end()) {
+        _value = found->second;
+        return;
+    }
+    _value = registry.names.size();
+    registry.names.push_back(name);
+    registry.ids.emplace(registry.names.back(), _value);
+}
+
+const std::string& AgentId::name() const {
+    auto& registry = AgentRegistry::instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    return registry.names[_value];
+}
+
+std::ostream& operator<<(std::ostream& os, AgentId agent_id) {
+    return os << agent_id.name();
+}
+
+#ifdef DPA_PRICE_FRACTION_BITS
+std::ostream& operator<<(std::ostream& os, Price price) {
+    return os << static_cast<float>(price);
+}
+#endif
+
+class BidPool {
+public:
+    static void* allocate() {
+        auto cache = Cache::local();
+        if (!cache) {
+            // bids allocated during thread teardown take slots straight from the shared pool
+            Cache temp;
+            instance().take(temp, 1);
+            return temp.free_slots;
+        }
+        if (!cache->free_slots) {
+            instance().take(*cache, SLAB_SIZE);
+        }
+        auto slot = cache->free_slots;
+        cache->free_slots = slot->next;
+        --cache->size;
+        return slot;
+    }
+
+    static void deallocate(void* ptr) {
+        auto slot = static_cast<Slot*>(ptr);
+        auto cache = Cache::local();
+        if (!cache) {
+            Cache temp{slot, 1};
+            slot->next = nullptr;
+            instance().give(temp, 1);
+            return;
+        }
+        slot->next = cache->free_slots;
+        cache->free_slots = slot;
+        // hand excess slots back so threads that only free bids don't hoard them
+        if (++cache->size > 2 * SLAB_SIZE) {
+            instance().give(*cache, SLAB_SIZE);
+        }
+    }
+
+private:
+    union Slot {
+        Slot* next;
+        alignas(Auction::Bid) unsigned char storage[sizeof(Auction::Bid)];
+    };
+
+    struct Cache {
+        Slot* free_slots = nullptr;
+        size_t size = 0;
+
+        // returns null once the calling thread's cache has been destroyed
+        static Cache* local() {
+            thread_local bool retired = false;
+            struct Local : Cache {
+                ~Local() { instance().give(*this, size), retired = true; }
+            };
+            thread_local Local cache;
+            return retired ? nullptr : &cache;
+        }
+    };
+
+    static constexpr size_t SLAB_SIZE = 256;
+
+    // slabs are never released, so the pool is intentionally leaked to outlive any static auctions
+    static BidPool& instance() {
+        static auto pool = new BidPool;
+        return *pool;
+    }
+
+    void take(Cache& cache, size_t count) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_free_slots) {
+            _slabs.emplace_back(new Slot[SLAB_SIZE]);
+            for (size_t i = 0; i < SLAB_SIZE; ++i) {
+                _slabs.back()[i].next = _free_slots;
+                _free_slots = &_slabs.back()[i];
+            }
+        }
+        for (; count && _free_slots; --count, ++cache.size) {
+            auto slot = _free_slots;
+            _free_slots = slot->next;
+            slot->next = cache.free_slots;
+            cache.free_slots = slot;
+        }
+    }
+
+    void give(Cache& cache, size_t count) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (; count && cache.free_slots; --count, --cache.size) {
+            auto slot = cache.free_slots;
+            cache.free_slots = slot->next;
+            slot->next = _free_slots;
+            _free_slots = slot;
+        }
+    }
+
+    std::mutex _mutex;
+    Slot* _free_slots = nullptr;
+    std::vector<std::unique_ptr<Slot[]>> _slabs;
+};
+
+void* Auction::Bid::operator new(size_t size) {
+    assert(size == sizeof(Bid));
+    return BidPool::allocate();
+}
+
+void Auction::Bid::operator delete(void* ptr) {
+    if (ptr) {
+        BidPool::deallocate(ptr);
+    }
+}
+
+// source of context versions, starting from one so that zero is never a valid version
+static std::atomic<size_t> version_sequence{0};
+
+// maintains a topological order of the bid graph as links change, based on the Pearce-Kelly algorithm
+// each bid links to the bids after it in time: its lower bid, the lower bid of its prev bid and its next bid
+// the order state is kept per context, so that the order of one graph's bids doesn't depend on writers of another
+class BidOrder {
+public:
+    using Bid = Auction::Bid;
+    using Reorders = std::vector<Auction::Reorder>;
+
+    BidOrder(Auction::Context& context)
+            : _context(context) {}
+
+    void initialize(Bid& bid) { bid.order = {0, _context._serial++}; }
+
+    // place a newly linked bid between the bids linking to it and the bids it links to
+    void place(Bid& bid, Reorders* reorders) {
+        save(bid, reorders);
+        const Bid* lo = nullptr;
+        const Bid* hi = nullptr;
+        forEachPredecessor(bid, [&](Bid& pred) {
+            if (!lo || lo->orderedBefore(pred)) {
+                lo = &pred;
+            }
+        });
+        forEachSuccessor(bid, [&](Bid& succ) {
+            // start bids have no links, so they are moved behind their predecessors instead when necessary
+            if (succ.lower && (!hi || succ.orderedBefore(*hi))) {
+                hi = &succ;
+            }
+        });
+        uint64_t rank = UINT64_MAX / 2;
+        if (lo && hi) {
+            rank = lo->order.first + (hi->order.first > lo->order.first ? (hi->order.first - lo->order.first) / 2 : 0);
+        } else if (lo) {
+            rank = lo->order.first + std::min(RANK_SPACING, (UINT64_MAX - lo->order.first) / 2);
+        } else if (hi) {
+            rank = hi->order.first - std::min(RANK_SPACING, hi->order.first / 2);
+        }
+        bid.order = {rank, _context._serial++};
+    }
+
+    // restore the order after links of the given bids changed
+    void update(std::initializer_list<Bid*> bids, Reorders* reorders) {
+        // flag every bid with a violating link first, so that bids are only reordered while the rest is ordered
+        for (auto bid : bids) {
+            if (bid && !bid->unordered && !isOrdered(*bid)) {
+                setUnordered(*bid, true, reorders);
+            }
+        }
+        for (auto bid : bids) {
+            if (bid && bid->unordered && _context._unordered_count == 1) {
+                reorderLinks(*bid, reorders);
+            }
+        }
+    }
+
+    // unlinked bids no longer violate the order
+    void clear(Bid& bid, Reorders* reorders) {
+        if (bid.unordered) {
+            setUnordered(bid, false, reorders);
+        }
+    }
+
+    // restore the order around a bid that was just unlinked, whose own links are still intact
+    void unlink(Bid& bid, Reorders* reorders) {
+        clear(bid, reorders);
+        update({bid.higher, bid.prev, bid.next, bid.higher ? bid.higher->next : nullptr}, reorders);
+    }
+
+    // revert order changes in reverse
+    static void revert(Reorders& reorders) {
+        for (auto reorder = reorders.rbegin(); reorder != reorders.rend(); ++reorder) {
+            reorder->context->_unordered_count += reorder->unordered - reorder->bid->unordered;
+            reorder->bid->order = reorder->order;
+            reorder->bid->unordered = reorder->unordered;
+        }
+        reorders.clear();
+    }
+
+private:
+    static constexpr uint64_t RANK_SPACING = uint64_t(1) << 32;
+
+    template <class F>
+    static void forEachSuccessor(const Bid& bid, F&& f) {
+        if (bid.lower) {
+            f(*bid.lower);
+        }
+        if (bid.prev && bid.prev->lower) {
+            f(*bid.prev->lower);
+        }
+        if (bid.next) {
+            f(*bid.next);
+        }
+    }
+
+    template <class F>
+    static void forEachPredecessor(const Bid& bid, F&& f) {
+        if (bid.higher) {
+            f(*bid.higher);
+            // the next bid of the higher bid links to the lower bid of its prev bid
+            if (bid.higher->next) {
+                f(*bid.higher->next);
+            }
+        }
+        if (bid.prev) {
+            f(*bid.prev);
+        }
+    }
+
+    static bool isOrdered(const Bid& bid) {
+        bool ordered = true;
+        forEachSuccessor(bid, [&](Bid& succ) { ordered &= bid.orderedBefore(succ); });
+        return ordered;
+    }
+
+    void save(Bid& bid, Reorders* reorders) {
+        if (reorders) {
+            reorders->push_back({&_context, &bid, bid.order, bid.unordered});
+        }
+    }
+
+    void setUnordered(Bid& bid, bool unordered, Reorders* reorders) {
+        save(bid, reorders);
+        bid.unordered = unordered;
+        unordered ? ++_context._unordered_count : --_context._unordered_count;
+    }
+
+    // reorder links of the only unordered bid, which remains unordered if any of its links closes a cycle
+    void reorderLinks(Bid& bid, Reorders* reorders) {
+        bool cycle = false;
+        forEachSuccessor(bid, [&](Bid& succ) {
+            if (!cycle && !bid.orderedBefore(succ)) {
+                cycle = !reorder(bid, succ, reorders);
+            }
+        });
+        if (!cycle) {
+            setUnordered(bid, false, reorders);
+        }
+    }
+
+    // reorder bids between a link from u to v that is ordered the wrong way, returns false if v reaches u
+    bool reorder(Bid& u, Bid& v, Reorders* reorders) {
+        // start bids have no links, so they can simply be moved behind u
+        if (!v.lower) {
+            save(v, reorders);
+            v.order = {u.order.first, _context._serial++};
+            return true;
+        }
+        // bids may be reordered while auctions are destroyed during thread exit, so avoid thread local storage
+        boost::container::small_vector<Bid*, 16> forward, backward, stack;
+        auto mark = [&stack](Bid& bid, boost::container::small_vector<Bid*, 16>& marked) {
+            bid.reordering = true;
+            marked.push_back(&bid);
+            stack.push_back(&bid);
+        };
+        // collect bids reachable from v that are ordered before u
+        bool cycle = false;
+        forward.clear();
+        mark(v, forward);
+        while (!stack.empty() && !cycle) {
+            auto bid = stack.back();
+            stack.pop_back();
+            forEachSuccessor(*bid, [&](Bid& succ) {
+                cycle |= &succ == &u;
+                if (!succ.reordering && succ.orderedBefore(u)) {
+                    mark(succ, forward);
+                }
+            });
+        }
+        stack.clear();
+        // collect bids reaching u that are ordered after v
+        backward.clear();
+        if (!cycle) {
+            mark(u, backward);
+            while (!stack.empty()) {
+                auto bid = stack.back();
+                stack.pop_back();
+                forEachPredecessor(*bid, [&](Bid& pred) {
+                    if (!pred.reordering && v.orderedBefore(pred)) {
+                        mark(pred, backward);
+                    }
+                });
+            }
+        }
+        for (auto bid : forward) {
+            bid->reordering = false;
+        }
+        for (auto bid : backward) {
+            bid->reordering = false;
+        }
+        if (cycle) {
+            return false;
+        }
+        // reassign the same set of positions with bids reaching u moved ahead of bids reachable from v
+        auto before = [](const Bid* a, const Bid* b) { return a->orderedBefore(*b); };
+        std::sort(forward.begin(), forward.end(), before);
+        std::sort(backward.begin(), backward.end(), before);
+        boost::container::small_vector<std::pair<uint64_t, uint64_t>, 32> orders;
+        for (auto bid : backward) {
+            orders.push_back(bid->order);
+        }
+        for (auto bid : forward) {
+            orders.push_back(bid->order);
+        }
+        std::inplace_merge(orders.begin(), orders.begin() + backward.size(), orders.end());
+        auto order = orders.begin();
+        for (auto bid : backward) {
+            save(*bid, reorders);
+            bid->order = *order++;
+        }
+        for (auto bid : forward) {
+            save(*bid, reorders);
+            bid->order = *order++;
+        }
+        return true;
+    }
+
+    Auction::Context& _context;
+};
+
+Auction::Context::Context()
+        : _version(++version_sequence) {}
+
+void Auction::Context::advance() {
+    _version = ++version_sequence;
+}
+
+const std::shared_ptr<Auction::Context>& Auction::Context::global() {
+    // intentionally leaked to outlive any static auctions
+    static auto context = new std::shared_ptr<Context>(new Context);
+    return *context;
+}
+
+Auction::Auction(Price start_price, std::shared_ptr<Context> context)
+        : _context(context ? std::move(context) : Context::global()) {
+    _bids.emplace(start_price, new Bid{});
+    _bids.begin()->second->context = _context.get();
+    BidOrder(*_context).initialize(*_bids.begin()->second);
+}
 
 Auction::~Auction() {
+    _context->advance();
+    // unlink bids from paths through other auctions, and mark them so that only remaining bids are reordered
+    boost::container::small_vector<Bid*, 16> relinked;
+    BidOrder order(*_context);
     for (auto& bid : _bids) {
-        if (bid.second.next) {
-            bid.second.next->prev = bid.second.prev;
+        auto prev = bid.second->prev;
+        auto next = bid.second->next;
+        if (next) {
+            next->prev = prev;
+        }
+        if (prev) {
+            prev->next = next;
         }
-        if (bid.second.prev) {
-            bid.second.prev->next = bid.second.next;
+        relinked.insert(relinked.end(), {prev, next});
+        bid.second->prev = bid.second->next = nullptr;
+        bid.second->reordering = true;
+        order.clear(*bid.second, nullptr);
+    }
+    for (auto bid : relinked) {
+        if (bid && !bid->reordering) {
+            order.update({bid}, nullptr);
         }
     }
 }
 
-Auction::Error Auction::insertBid(const std::string& bidder, float price, float duration, Bid*& prev) {
+// propagate run lengths upward and downward from a changed position until they stop changing
+static void updateLowerRuns(Auction::Bid* bid) {
+    for (; bid; bid = bid->higher) {
+        uint32_t run = bid->lower && bid->lower->bidder == bid->bidder ? bid->lower->lower_run + 1 : 0;
+        if (run == bid->lower_run) {
+            break;
+        }
+        bid->lower_run = run;
+    }
+}
+
+static void updateHigherRuns(Auction::Bid* bid) {
+    for (; bid; bid = bid->lower) {
+        uint32_t run = bid->higher && bid->higher->bidder == bid->bidder ? bid->higher->higher_run + 1 : 0;
+        if (run == bid->higher_run) {
+            break;
+        }
+        bid->higher_run = run;
+    }
+}
+
+static void updateRuns(Auction::Bid& bid) {
+    bid.lower_run = bid.lower && bid.lower->bidder == bid.bidder ? bid.lower->lower_run + 1 : 0;
+    bid.higher_run = bid.higher && bid.higher->bidder == bid.bidder ? bid.higher->higher_run + 1 : 0;
+    updateLowerRuns(bid.higher);
+    updateHigherRuns(bid.lower);
+}
+
+static void unlinkBid(Auction::Bid& bid) {
+    bid.context->advance();
+    if (bid.next) {
+        bid.next->prev = bid.prev;
+    }
+    if (bid.prev) {
+        bid.prev->next = bid.next;
+    }
+    if (bid.higher) {
+        bid.higher->lower = bid.lower;
+    }
+    // start bid must exist
+    assert(bid.lower);
+    bid.lower->higher = bid.higher;
+    updateLowerRuns(bid.higher);
+    updateHigherRuns(bid.lower);
+}
+
+Auction::Error Auction::checkBid(AgentId bidder, Price price, float duration, const Bid* prev) const {
     // must contain bidder name
     if (bidder.empty()) {
         return BIDDER_EMPTY;
@@ -33,34 +493,62 @@ Auction::Error Auction::insertBid(const std::string& bidder, float price, float
     if (prev && prev->bidder != bidder) {
         return BIDDER_MISMATCH;
     }
-    // insert bid
-    auto [it, result] = _bids.insert({price, {bidder, duration}});
-    // reject if same price bid already exists
-    if (!result) {
-        return PRICE_ALREADY_EXIST;
-    }
+    return SUCCESS;
+}
+
+void Auction::linkBid(Bids::iterator it, Bid*& prev, std::vector<Reorder>* reorders) {
+    _context->advance();
+    auto bid = it->second.get();
+    bid->context = _context.get();
     // update prev and next link
     if (prev) {
-        if ((it->second.next = prev->next)) {
-            prev->next->prev = &it->second;
+        if ((bid->next = prev->next)) {
+            prev->next->prev = bid;
         }
-        prev->next = &it->second;
+        prev->next = bid;
+    }
+    bid->prev = prev;
+    prev = bid;
+    // update higher and lower link, skipping over bids unlinked by a transaction
+    auto higher = std::next(it);
+    while (higher != _bids.end() && !higher->second->lower) {
+        ++higher;
     }
-    it->second.prev = prev;
-    prev = &it->second;
-    // update higher and lower link
-    if (std::next(it) != _bids.end()) {
-        std::next(it)->second.lower = &it->second;
-        it->second.higher = &std::next(it)->second;
+    if (higher != _bids.end()) {
+        higher->second->lower = bid;
+        bid->higher = higher->second.get();
     }
     // start bid must exist
-    assert(std::prev(it) != _bids.end());
-    std::prev(it)->second.higher = &it->second;
-    it->second.lower = &std::prev(it)->second;
+    assert(it != _bids.begin());
+    auto lower = std::prev(it);
+    while (lower != _bids.begin() && !lower->second->lower) {
+        --lower;
+    }
+    lower->second->higher = bid;
+    bid->lower = lower->second.get();
+    updateRuns(*bid);
+    // order bid with links to it and from it, including links that changed by linking it in between
+    BidOrder order(*_context);
+    order.place(*bid, reorders);
+    order.update({bid, bid->higher, bid->prev, bid->next, bid->higher ? bid->higher->next : nullptr}, reorders);
+}
+
+Auction::Error Auction::insertBid(AgentId bidder, Price price, float duration, Bid*& prev) {
+    if (auto error = checkBid(bidder, price, duration, prev)) {
+        return error;
+    }
+    // insert bid
+    auto [it, result] = _bids.try_emplace(price);
+    // reject if same price bid already exists
+    if (!result) {
+        return PRICE_ALREADY_EXIST;
+    }
+    it->second.reset(new Bid{bidder, duration});
+    linkBid(it, prev);
     return SUCCESS;
 }
 
-Auction::Error Auction::removeBid(const std::string& bidder, float price) {
+Auction::Error Auction::removeBid(AgentId bidder, Price price) {
     // don't remove start price
     if (bidder.empty()) {
         return BIDDER_EMPTY;
@@ -70,35 +558,24 @@ Auction::Error Auction::removeBid(const std::string& bidder, float price) {
     if (found == _bids.end()) {
         return PRICE_NOT_FOUND;
     }
-    auto& bid = found->second;
-    if (bid.bidder != bidder) {
+    if (found->second->bidder != bidder) {
         return BIDDER_NOT_FOUND;
     }
-    // fix links after deletion
-    if (bid.next) {
-        bid.next->prev = bid.prev;
-    }
-    if (bid.prev) {
-        bid.prev->next = bid.next;
-    }
-    if (std::next(found) != _bids.end()) {
-        std::next(found)->second.lower = bid.lower;
-    }
-    assert(std::prev(found) != _bids.end());
-    std::prev(found)->second.higher = bid.higher;
+    unlinkBid(*found->second);
+    BidOrder(*_context).unlink(*found->second, nullptr);
     // erase bid
     _bids.erase(found);
     return SUCCESS;
 }
 
-Auction::Error Auction::changeBid(float old_price, float new_price) {
+Auction::Error Auction::changeBid(Price old_price, Price new_price) {
     // find old bid
     auto found = _bids.find(old_price);
     if (found == _bids.end()) {
         return PRICE_NOT_FOUND;
     }
     // insert new bid
-    auto bid = &found->second;
+    auto bid = found->second.get();
     if (auto error = insertBid(bid->bidder, new_price, bid->duration, bid)) {
         return error;
     }
@@ -109,62 +586,323 @@ Auction::Error Auction::changeBid(float old_price, float new_price) {
     return SUCCESS;
 }
 
-Auction::Bids::const_iterator Auction::getHigherBid(float price, const std::string& exclude_bidder) const {
+Auction::Bids::const_iterator Auction::getHigherBid(Price price, AgentId exclude_bidder) const {
     auto bid = _bids.upper_bound(price);
-    while (!exclude_bidder.empty() && bid != _bids.end() && bid->second.bidder == exclude_bidder) {
+    if (exclude_bidder.empty() || bid == _bids.end() || bid->second->bidder != exclude_bidder) {
+        return bid;
+    }
+    if (!_unlinked_count) {
+        return bid + bid->second->higher_run + 1;
+    }
+    while (bid != _bids.end() && bid->second->bidder == exclude_bidder) {
         ++bid;
     }
     return bid;
 }
 
-Auction::Bids::const_iterator Auction::getHighestBid(const std::string& exclude_bidder) const {
+Auction::Bids::const_iterator Auction::getHighestBid(AgentId exclude_bidder) const {
     auto bid = std::prev(_bids.end());
-    while (!exclude_bidder.empty() && bid != _bids.begin() && bid->second.bidder == exclude_bidder) {
+    // start bid has no bidder, so the run never reaches past it
+    if (exclude_bidder.empty() || bid->second->bidder != exclude_bidder) {
+        return bid;
+    }
+    if (!_unlinked_count) {
+        return bid - (bid->second->lower_run + 1);
+    }
+    while (bid->second->bidder == exclude_bidder) {
         --bid;
     }
     return bid;
 }
 
-bool Auction::Bid::detectCycle(std::vector<CycleVisit>& visits, size_t nonce, const std::string& exclude_bidder) const {
-    assert(id < visits.size());
-    // cycle occured if previously visited ancestor bid was visited again
-    if (visits[id].nonce == nonce) {
-        return visits[id].in_cycle;
+Auction::Error Auction::Transaction::insertBid(
+        Auction& auction, AgentId bidder, Price price, float duration, Bid*& prev) {
+    if (auto error = auction.checkBid(bidder, price, duration, prev)) {
+        return error;
+    }
+    auto [it, result] = auction._bids.try_emplace(price);
+    auto bid = it->second.get();
+    if (result) {
+        it->second.reset(bid = new Bid{bidder, duration});
+        _changes.push_back({INSERT, &auction, price, bid});
+    } else if (!bid->lower) {
+        // reuse bid removed earlier in the transaction instead of erasing and reallocating it
+        _changes.push_back({REUSE, &auction, price, bid, bid->bidder, bid->duration});
+        --auction._unlinked_count;
+        bid->bidder = bidder;
+        bid->duration = duration;
+        bid->id.acquire();
+    } else {
+        return PRICE_ALREADY_EXIST;
+    }
+    auction.linkBid(it, prev, &_reorders);
+    return SUCCESS;
+}
+
+Auction::Error Auction::Transaction::removeBid(Auction& auction, AgentId bidder, Price price) {
+    // don't remove start price
+    if (bidder.empty()) {
+        return BIDDER_EMPTY;
+    }
+    auto found = auction._bids.find(price);
+    if (found == auction._bids.end()) {
+        return PRICE_NOT_FOUND;
+    }
+    auto bid = found->second.get();
+    if (bid->bidder != bidder) {
+        return BIDDER_NOT_FOUND;
+    }
+    // bid was already removed within this transaction
+    if (!bid->lower) {
+        return PRICE_NOT_FOUND;
+    }
+    // keep bid in place until commit, unlinked bids are skipped by link traversals
+    _changes.push_back({REMOVE, &auction, price, bid, bid->bidder, bid->duration, bid->prev, bid->next, bid->lower,
+            bid->higher});
+    unlinkBid(*bid);
+    ++auction._unlinked_count;
+    BidOrder(*auction._context).unlink(*bid, &_reorders);
+    bid->prev = bid->next = bid->lower = bid->higher = nullptr;
+    bid->id.release();
+    return SUCCESS;
+}
+
+void Auction::Transaction::commit() {
+    // erase bids that remain unlinked
+    for (auto& change : _changes) {
+        if (change.type != REMOVE) {
+            continue;
+        }
+        // the same slot may have been removed more than once, so check the bid is still there before access
+        auto& bids = change.auction->_bids;
+        auto found = bids.find(change.price);
+        if (found != bids.end() && found->second.get() == change.bid && !change.bid->lower) {
+            bids.erase(found);
+            --change.auction->_unlinked_count;
+        }
+    }
+    _changes.clear();
+    _reorders.clear();
+}
+
+void Auction::Transaction::rollback() {
+    // restore the order first, reverted links then match the order they had before
+    BidOrder::revert(_reorders);
+    // release ids of inserted bids before removed bids take theirs back, in the same order as sequential updates
+    for (auto& change : _changes) {
+        if (change.type != REMOVE) {
+            change.bid->id.release();
+        }
+    }
+    // undo changes in reverse order so that every saved link is valid again when restored
+    for (auto change = _changes.rbegin(); change != _changes.rend(); ++change) {
+        auto bid = change->bid;
+        switch (change->type) {
+            case INSERT:
+                unlinkBid(*bid);
+                change->auction->_bids.erase(change->price);
+                break;
+            case REUSE:
+                unlinkBid(*bid);
+                bid->bidder = change->bidder;
+                bid->duration = change->duration;
+                bid->prev = bid->next = bid->lower = bid->higher = nullptr;
+                ++change->auction->_unlinked_count;
+                break;
+            case REMOVE:
+                bid->context->advance();
+                bid->prev = change->prev;
+                bid->next = change->next;
+                bid->lower = change->lower;
+                bid->higher = change->higher;
+                if (bid->next) {
+                    bid->next->prev = bid;
+                }
+                if (bid->prev) {
+                    bid->prev->next = bid;
+                }
+                if (bid->higher) {
+                    bid->higher->lower = bid;
+                }
+                bid->lower->higher = bid;
+                updateRuns(*bid);
+                --change->auction->_unlinked_count;
+                break;
+        }
+    }
+    for (auto& change : _changes) {
+        if (change.type == REMOVE) {
+            change.bid->id.acquire();
+        }
+    }
+    _changes.clear();
+}
+
+void Auction::ReadLock::lock() {
+    if (_locked || !_mutex) {
+        return;
+    }
+    std::lock_guard<std::mutex> queue(_mutex->_queue);
+    _mutex->_mutex.lock_shared();
+    _version = _mutex->_version;
+    _locked = true;
+}
+
+void Auction::ReadLock::unlock() {
+    if (_locked) {
+        _mutex->_mutex.unlock_shared();
+        _locked = false;
+    }
+}
+
+bool Auction::ReadLock::yield() {
+    if (!_locked || !_mutex->_waiting_writers) {
+        return false;
+    }
+    size_t version = _version;
+    unlock();
+    lock();
+    return _version != version;
+}
+
+Auction::WriteLock::WriteLock(Mutex* mutex)
+        : _mutex(mutex) {
+    if (!_mutex) {
+        return;
+    }
+    ++_mutex->_waiting_writers;
+    std::lock_guard<std::mutex> queue(_mutex->_queue);
+    _mutex->_mutex.lock();
+    --_mutex->_waiting_writers;
+}
+
+Auction::WriteLock::~WriteLock() {
+    if (_mutex) {
+        ++_mutex->_version;
+        _mutex->_mutex.unlock();
     }
-    // mark traversed bids as visited
-    visits[id].nonce = nonce;
-    visits[id].in_cycle = 1;
-    bool next_temp = next && visits[next->id].in_cycle >> 1 && visits[next->id].nonce == nonce;
+}
+
+bool Auction::Bid::detectCycle(std::vector<CycleVisit>& visits, size_t nonce, AgentId exclude_bidder,
+        const Bid* last, size_t ancestor_nonce) const {
+    // depth first search on an explicit stack, each frame resumes at the stage after its last traversed link
+    enum Stage { LOWER, PREV_LOWER, NEXT, DONE };
+    struct Frame {
+        const Bid* bid;
+        int stage;
+        size_t next_nonce;
+    };
+    // frames are kept between calls to avoid reallocating the stack
+    thread_local std::vector<Frame> stack;
+    size_t depth = 0;
+    bool result = false;
+    auto visit = [&](const Bid* bid) {
+        assert(bid->id < visits.size());
+        // cycle occured if previously visited ancestor bid was visited again
+        if (visits[bid->id].nonce == nonce || (ancestor_nonce && visits[bid->id].nonce == ancestor_nonce)) {
+            result = visits[bid->id].in_cycle;
+            return;
+        }
+        // bids ordered after the last bid only link to bids ordered even later, so they can't lead to a cycle
+        if (last && last->orderedBefore(*bid)) {
+            visits[bid->id] = {nonce, 0};
+            result = false;
+            return;
+        }
+        // mark traversed bids as visited
+        visits[bid->id].nonce = nonce;
+        visits[bid->id].in_cycle = 1;
+        size_t next_nonce = bid->next && visits[bid->next->id].in_cycle >> 1 ? visits[bid->next->id].nonce : 0;
+        if (next_nonce != nonce && (!ancestor_nonce || next_nonce != ancestor_nonce)) {
+            next_nonce = 0;
+        }
+        if (depth == stack.size()) {
+            stack.resize(std::max<size_t>(2 * depth, 64));
+        }
+        stack[depth++] = {bid, LOWER, next_nonce};
+    };
+    auto finish = [&](bool in_cycle) {
+        visits[stack[--depth].bid->id].in_cycle = result = in_cycle;
+    };
     // detect cycle for next bids in time (first by auction rank, then by path sequence)
-    return (visits[id].in_cycle =
-                    // detect cycle at next lower bid
-            (lower && lower->detectCycle(visits, nonce, exclude_bidder)) ||
-            // skip the current bid's path if the bidder is excluded
-            (bidder != exclude_bidder &&
-                    // detect cycle at next lower bid of previous bid
-                    ((prev && prev->lower && prev->lower->detectCycle(visits, nonce, exclude_bidder)) ||
-                            // clear flag on next bid for temporary bids inbetween existing bids
-                            (next && (visits[next->id].nonce -= next_temp,
-                                             // detect cycle at next bid
-                                             next->detectCycle(visits, nonce, exclude_bidder),
-                                             // restore temporary bid flag after call
-                                             (visits[next->id].in_cycle |= next_temp << 1) & 1)))));
-}
-
-float Auction::Bid::waitDuration(const std::string& exclude_bidder) const {
-    thread_local std::vector<bool> visits;
-    if (id >= visits.size()) {
-        visits.resize(id + 1);
-    }
-    if (visits[id]) {
-        return std::numeric_limits<float>::max();
-    }
-    visits[id] = true;
+    visit(this);
+    while (depth) {
+        // copy frame state since visiting a bid may reallocate the stack
+        auto [bid, stage, next_nonce] = stack[depth - 1];
+        switch (stage) {
+            case LOWER:
+                // detect cycle at next lower bid
+                if (bid->lower) {
+                    stack[depth - 1].stage = PREV_LOWER;
+                    visit(bid->lower);
+                    break;
+                }
+                result = false;
+                [[fallthrough]];
+            case PREV_LOWER:
+                // skip the current bid's path if the bidder is excluded
+                if (result || bid->bidder == exclude_bidder) {
+                    finish(result);
+                    break;
+                }
+                // detect cycle at next lower bid of previous bid
+                if (bid->prev && bid->prev->lower) {
+                    stack[depth - 1].stage = NEXT;
+                    visit(bid->prev->lower);
+                    break;
+                }
+                [[fallthrough]];
+            case NEXT:
+                if (result || !bid->next) {
+                    finish(result);
+                    break;
+                }
+                // clear flag on next bid for temporary bids inbetween existing bids
+                if (next_nonce) {
+                    visits[bid->next->id].nonce = 0;
+                }
+                // detect cycle at next bid
+                stack[depth - 1].stage = DONE;
+                visit(bid->next);
+                break;
+            case DONE:
+                // restore temporary bid flag after call, including the nonce it was marked with
+                if (next_nonce) {
+                    visits[bid->next->id].nonce = next_nonce;
+                    visits[bid->next->id].in_cycle |= 2;
+                }
+                finish(visits[bid->next->id].in_cycle & 1);
+                break;
+        }
+    }
+    return result;
+}
+
+float Auction::Bid::waitDuration(AgentId exclude_bidder) const {
+    // results stay valid until bid links change, so repeated queries in between are answered from the cache
+    // entries are keyed by bid id and tagged with the version of the bid's context when cached
+    // ids are only handed to another bid after unlinking the bid holding it, which advances that bid's context
+    // so entries of a previous holder never match, whether the new holder shares its context or not
+    struct CachedWait {
+        size_t version;
+        AgentId exclude_bidder;
+        float duration;
+    };
+    thread_local std::vector<CachedWait> cache;
+    if (id >= cache.size()) {
+        cache.resize(id + 1);
+    }
+    size_t version = context->version();
+    if (cache[id].version == version && cache[id].exclude_bidder == exclude_bidder) {
+        return cache[id].duration;
+    }
+    // bids reached again while still being evaluated are part of a cycle
+    cache[id] = {version, exclude_bidder, std::numeric_limits<float>::max()};
     float higher_wait_duration = higher ? higher->waitDuration(exclude_bidder) : 0;
     float prev_wait_duration =
             bidder == exclude_bidder ? 0 : (duration + (prev ? prev->waitDuration(exclude_bidder) : 0));
-    visits[id] = false;
-    return std::max(higher_wait_duration, prev_wait_duration);
+    // cache may have been resized by recursive calls
+    return cache[id].duration = std::max(higher_wait_duration, prev_wait_duration);
 }
 
 }  // namespace decentralized_path_auction
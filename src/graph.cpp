@@ -1,5 +1,17 @@
 #include <decentralized_path_auction/graph.hpp>
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <queue>
+#include <tuple>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace decentralized_path_auction {
 
 bool NodeRTree::insertNode(NodePtr node) {
@@ -7,7 +19,7 @@ bool NodeRTree::insertNode(NodePtr node) {
         return false;
     }
     // reject nodes with duplicate positions
-    if (findNode(node->position)) {
+    if (!_index.insert(node)) {
         return false;
     }
     // insert to rtree
@@ -16,30 +28,466 @@ bool NodeRTree::insertNode(NodePtr node) {
     return true;
 }
 
+template <size_t... I>
+static void copyPosition(float* dst, const Point& position, std::index_sequence<I...>) {
+    ((dst[I] = bg::get<I>(position)), ...);
+}
+
+template <size_t... I>
+static Point makePosition(const float* src, std::index_sequence<I...>) {
+    return Point(src[I]...);
+}
+
+static uint64_t mixHash(uint64_t hash) {
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111eb;
+    return hash ^ (hash >> 31);
+}
+
+template <size_t... I>
+static size_t positionHash(const Point& position, std::index_sequence<I...>) {
+    uint64_t hash = 0;
+    // adding zero turns negative zero into positive zero, since both are the same position
+    auto combine = [&hash](float coordinate) {
+        uint32_t bits;
+        coordinate += 0.0f;
+        memcpy(&bits, &coordinate, sizeof(bits));
+        hash = mixHash(hash ^ bits);
+    };
+    (combine(bg::get<I>(position)), ...);
+    return hash;
+}
+
+template <size_t... I>
+static bool positionEqual(const Point& a, const Point& b, std::index_sequence<I...>) {
+    return ((bg::get<I>(a) == bg::get<I>(b)) && ...);
+}
+
+const NodePtr& NodePositionIndex::find(const Point& position) const {
+    static const NodePtr not_found = nullptr;
+    if (_slots.empty()) {
+        return not_found;
+    }
+    // empty slots hold null nodes
+    return _slots[findSlot(position, positionHash(position, std::make_index_sequence<DPA_NDIM>()))].node;
+}
+
+bool NodePositionIndex::insert(const NodePtr& node) {
+    reserve(_size + 1);
+    size_t hash = positionHash(node->position, std::make_index_sequence<DPA_NDIM>());
+    auto& slot = _slots[findSlot(node->position, hash)];
+    if (slot.node) {
+        return false;
+    }
+    slot = {hash, node};
+    ++_size;
+    return true;
+}
+
+bool NodePositionIndex::remove(const NodePtr& node) {
+    if (_slots.empty()) {
+        return false;
+    }
+    size_t i = findSlot(node->position, positionHash(node->position, std::make_index_sequence<DPA_NDIM>()));
+    if (_slots[i].node != node) {
+        return false;
+    }
+    // shift following slots of the probe sequence back into the gap, unless the gap lies before their home slot
+    size_t mask = _slots.size() - 1;
+    for (size_t j = (i + 1) & mask; _slots[j].node; j = (j + 1) & mask) {
+        if (((j - (_slots[j].hash & mask)) & mask) >= ((j - i) & mask)) {
+            _slots[i] = std::move(_slots[j]);
+            i = j;
+        }
+    }
+    _slots[i] = {};
+    --_size;
+    return true;
+}
+
+size_t NodePositionIndex::findSlot(const Point& position, size_t hash) const {
+    size_t mask = _slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        auto& slot = _slots[i];
+        if (!slot.node || (slot.hash == hash && positionEqual(slot.node->position, position,
+                                                        std::make_index_sequence<DPA_NDIM>()))) {
+            return i;
+        }
+    }
+}
+
+void NodePositionIndex::reserve(size_t size) {
+    // keep the load factor at or below one half so that probe sequences stay short
+    size_t capacity = std::max<size_t>(_slots.size(), 16);
+    while (capacity < size * 2) {
+        capacity *= 2;
+    }
+    if (capacity == _slots.size()) {
+        return;
+    }
+    std::vector<Slot> slots(capacity);
+    slots.swap(_slots);
+    for (auto& slot : slots) {
+        if (slot.node) {
+            _slots[findSlot(slot.node->position, slot.hash)] = std::move(slot);
+        }
+    }
+}
+
+size_t NodeRTree::insertNodes(Nodes nodes) {
+    // reject invalid nodes and nodes at positions that are already taken, including by earlier nodes in the batch
+    _index.reserve(_index.size() + nodes.size());
+    nodes.erase(std::remove_if(nodes.begin(), nodes.end(),
+                        [this](const NodePtr& node) { return !Node::validate(node) || !_index.insert(node); }),
+            nodes.end());
+    // pack existing and new nodes together into a balanced tree
+    std::vector<RTreeNode> rt_nodes(_nodes.begin(), _nodes.end());
+    rt_nodes.reserve(rt_nodes.size() + nodes.size());
+    for (auto& node : nodes) {
+        rt_nodes.emplace_back(node->position, std::move(node));
+    }
+    RTree(rt_nodes.begin(), rt_nodes.end()).swap(_nodes);
+    return nodes.size();
+}
+
 bool NodeRTree::removeNode(NodePtr node) {
     if (!node) {
         return false;
     }
     // remove from rtree
     auto pos = node->position;
-    return _nodes.remove({pos, std::move(node)});
+    return _nodes.remove({pos, node}) && _index.remove(node);
 }
 
-NodePtr NodeRTree::findNearestNode(Point position, Node::State criterion) const {
+const NodePtr& NodeRTree::findNearestNode(Point position, Node::State criterion) const {
     return query(bg::index::nearest(position, 1) && bg::index::satisfies([criterion](const RTreeNode& rt_node) {
         return rt_node.second->state <= criterion;
     }));
 }
 
-NodePtr NodeRTree::findAnyNode(Node::State criterion) const {
+const NodePtr& NodeRTree::findAnyNode(Node::State criterion) const {
     return query(
             bg::index::satisfies([criterion](const RTreeNode& rt_node) { return rt_node.second->state <= criterion; }));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
+CompactGraph::CompactGraph(const NodeRTree& graph, TravelTime travel_time)
+        : _travel_time(std::move(travel_time)) {
+    auto insert = [this](const NodePtr& node) {
+        auto [found, inserted] = _indices.emplace(node.get(), _nodes.size());
+        if (inserted) {
+            _nodes.push_back(node);
+        }
+        return found->second;
+    };
+    for (auto& rt_node : graph.getNodes()) {
+        insert(rt_node.second);
+    }
+    // nodes are appended while their predecessors are packed, until no new nodes are reached
+    for (Index index = 0; index < _nodes.size(); ++index) {
+        auto node = _nodes[index].get();
+        for (auto& adj_node : node->edges) {
+            if (Node::validate(adj_node) && adj_node.get() != node) {
+                _edges.push_back(insert(adj_node));
+            }
+        }
+        _offsets.push_back(_edges.size());
+    }
+    // reverse edges are counted per node first, then filled into each node's range in order of their source
+    _reverse_offsets.assign(_nodes.size() + 1, 0);
+    for (Index edge : _edges) {
+        ++_reverse_offsets[edge + 1];
+    }
+    std::partial_sum(_reverse_offsets.begin(), _reverse_offsets.end(), _reverse_offsets.begin());
+    _reverse_edges.resize(_edges.size());
+    auto reverse_ends = _reverse_offsets;
+    for (Index index = 0; index < _nodes.size(); ++index) {
+        for (auto edge = _offsets[index]; edge < _offsets[index + 1]; ++edge) {
+            _reverse_edges[reverse_ends[_edges[edge]]++] = index;
+        }
+    }
+    if (!_travel_time) {
+        return;
+    }
+    // each node has a row of travel times to its edges for every adjacent previous node, plus one for no previous node
+    _turn_offsets.reserve(_nodes.size() + 1);
+    _turn_offsets.push_back(0);
+    for (Index index = 0; index < _nodes.size(); ++index) {
+        size_t degree = _offsets[index + 1] - _offsets[index];
+        _turn_offsets.push_back(_turn_offsets.back() + (degree + 1) * degree);
+    }
+    _travel_times.resize(_turn_offsets.back());
+    for (Index index = 0; index < _nodes.size(); ++index) {
+        cacheTravelTimes(index);
+    }
+}
+
+void CompactGraph::cacheTravelTimes(Index index) {
+    static const NodePtr no_node;
+    auto travel_times = _travel_times.data() + _turn_offsets[index];
+    auto& node = _nodes[index];
+    auto edges = getEdges(index);
+    for (auto& next : edges) {
+        *travel_times++ = _travel_time(no_node, node, next);
+    }
+    for (auto& prev : edges) {
+        for (auto& next : edges) {
+            *travel_times++ = _travel_time(prev, node, next);
+        }
+    }
+}
+
+const float* CompactGraph::getTravelTimes(Index index, const Node* prev) const {
+    if (_travel_times.empty()) {
+        return nullptr;
+    }
+    const Index* begin = _edges.data() + _offsets[index];
+    const Index* end = _edges.data() + _offsets[index + 1];
+    size_t row = 0;
+    if (prev) {
+        auto found = std::find_if(begin, end, [&](Index edge) { return _nodes[edge].get() == prev; });
+        if (found == end) {
+            return nullptr;
+        }
+        row = found - begin + 1;
+    }
+    return _travel_times.data() + _turn_offsets[index] + row * (end - begin);
+}
+
+void CompactGraph::updateTravelTimes(const Node* node) {
+    ++_state_version;
+    auto node_index = findIndex(node);
+    if (_travel_times.empty() || node_index == NONE) {
+        return;
+    }
+    // the node is part of every turn through itself, and of turns through nodes with an edge to it
+    cacheTravelTimes(node_index);
+    for (auto edge = _reverse_offsets[node_index]; edge < _reverse_offsets[node_index + 1]; ++edge) {
+        cacheTravelTimes(_reverse_edges[edge]);
+    }
+}
+
+CompactGraph::Index CompactGraph::findIndex(const Node* node) const {
+    auto found = _indices.find(node);
+    return found == _indices.end() ? NONE : found->second;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Landmarks::Landmarks(std::shared_ptr<const CompactGraph> graph, size_t count, const TravelTime& travel_time)
+        : _graph(std::move(graph)) {
+    size_t size = _graph->size();
+    count = std::min(count, size);
+    _landmarks.assign(count, 0);
+    _from_landmarks.resize(size * count);
+    _to_landmarks.resize(size * count);
+    // the first landmark is the node farthest from the first node, found by searching from it in place of a landmark
+    // nodes unreached by any landmark so far are the farthest
+    std::vector<float> min_travel_times(size, FLT_MAX);
+    if (count) {
+        searchLandmark(0, travel_time, false);
+        for (CompactGraph::Index index = 0; index < size; ++index) {
+            min_travel_times[index] = _from_landmarks[index * count];
+        }
+    }
+    for (size_t landmark = 0; landmark < count; ++landmark) {
+        _landmarks[landmark] = std::max_element(min_travel_times.begin(), min_travel_times.end()) -
+                               min_travel_times.begin();
+        searchLandmark(landmark, travel_time, false);
+        searchLandmark(landmark, travel_time, true);
+        for (CompactGraph::Index index = 0; index < size; ++index) {
+            auto& min_travel_time = min_travel_times[index];
+            float landmark_travel_time = _from_landmarks[index * count + landmark];
+            min_travel_time = landmark ? std::min(min_travel_time, landmark_travel_time) : landmark_travel_time;
+        }
+    }
+}
+
+void Landmarks::searchLandmark(size_t landmark, const TravelTime& travel_time, bool reverse) {
+    static const NodePtr no_node;
+    size_t count = _landmarks.size();
+    auto& travel_times = reverse ? _to_landmarks : _from_landmarks;
+    for (CompactGraph::Index index = 0; index < _graph->size(); ++index) {
+        travel_times[index * count + landmark] = FLT_MAX;
+    }
+    // dijkstra over edges from the landmark, or over reverse edges towards it
+    using QueueEntry = std::pair<float, CompactGraph::Index>;
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry>> queue;
+    travel_times[_landmarks[landmark] * count + landmark] = 0;
+    queue.push({0, _landmarks[landmark]});
+    while (!queue.empty()) {
+        auto [node_travel_time, index] = queue.top();
+        queue.pop();
+        if (node_travel_time > travel_times[index * count + landmark]) {
+            continue;
+        }
+        auto& node = _graph->getNode(index);
+        auto adj_nodes = reverse ? _graph->getReverseEdges(index) : _graph->getEdges(index);
+        for (auto adj_node = adj_nodes.begin(); adj_node != adj_nodes.end(); ++adj_node) {
+            float adj_travel_time = node_travel_time;
+            adj_travel_time += reverse ? travel_time(no_node, *adj_node, node) : travel_time(no_node, node, *adj_node);
+            auto& min_travel_time = travel_times[adj_node.index() * count + landmark];
+            if (adj_travel_time < min_travel_time) {
+                min_travel_time = adj_travel_time;
+                queue.push({adj_travel_time, adj_node.index()});
+            }
+        }
+    }
+}
+
+float Landmarks::lowerBound(CompactGraph::Index from, CompactGraph::Index to) const {
+    size_t count = _landmarks.size();
+    auto from_landmarks = &_from_landmarks[from * count];
+    auto to_landmarks = &_to_landmarks[from * count];
+    auto goal_from_landmarks = &_from_landmarks[to * count];
+    auto goal_to_landmarks = &_to_landmarks[to * count];
+    float bound = 0;
+    // bounds through unreachable landmarks are skipped
+    for (size_t landmark = 0; landmark < count; ++landmark) {
+        if (from_landmarks[landmark] < FLT_MAX && goal_from_landmarks[landmark] < FLT_MAX) {
+            bound = std::max(bound, goal_from_landmarks[landmark] - from_landmarks[landmark]);
+        }
+        if (to_landmarks[landmark] < FLT_MAX && goal_to_landmarks[landmark] < FLT_MAX) {
+            bound = std::max(bound, to_landmarks[landmark] - goal_to_landmarks[landmark]);
+        }
+    }
+    return bound;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// graph files consist of the header followed by node positions, edge offsets, edges and node states
+// each section is a packed array in native byte order, where nodes are stored in the order of the packed tree
+struct GraphFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ndim;
+    uint32_t node_count;
+    uint32_t edge_count;
+};
+
+static constexpr uint32_t GRAPH_FILE_MAGIC = 0x47415044;
+static constexpr uint32_t GRAPH_FILE_VERSION = 1;
+
+static size_t graphFileSize(const GraphFileHeader& header) {
+    return sizeof(GraphFileHeader) + sizeof(float) * header.ndim * header.node_count +
+           sizeof(uint32_t) * (header.node_count + 1) + sizeof(uint32_t) * header.edge_count +
+           sizeof(uint8_t) * header.node_count;
+}
+
+// reads nodes linked by their edges, returns false if the data is not a valid graph file
+static bool readGraphFile(
+        const char* data, size_t size, const std::shared_ptr<Auction::Context>& auction_context, Nodes& nodes) {
+    GraphFileHeader header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != GRAPH_FILE_MAGIC || header.version != GRAPH_FILE_VERSION || header.ndim != DPA_NDIM ||
+            size != graphFileSize(header)) {
+        return false;
+    }
+    // sections are 4 byte aligned within the page aligned mapping, so they are read in place
+    auto positions = reinterpret_cast<const float*>(data + sizeof(header));
+    auto offsets = reinterpret_cast<const uint32_t*>(positions + DPA_NDIM * header.node_count);
+    auto edges = offsets + header.node_count + 1;
+    auto states = reinterpret_cast<const uint8_t*>(edges + header.edge_count);
+    if (offsets[0] != 0 || offsets[header.node_count] != header.edge_count ||
+            std::any_of(edges, edges + header.edge_count, [&](uint32_t edge) { return edge >= header.node_count; }) ||
+            std::any_of(states, states + header.node_count, [](uint8_t state) { return state >= Node::DELETED; }) ||
+            !std::is_sorted(offsets, offsets + header.node_count + 1)) {
+        return false;
+    }
+    nodes.resize(header.node_count);
+    for (uint32_t i = 0; i < header.node_count; ++i) {
+        auto position = makePosition(positions + DPA_NDIM * i, std::make_index_sequence<DPA_NDIM>());
+        nodes[i] = NodePtr(new Node{position, static_cast<Node::State>(states[i]), {}, {0, auction_context}});
+    }
+    for (uint32_t i = 0; i < header.node_count; ++i) {
+        auto& node_edges = nodes[i]->edges;
+        node_edges.reserve(offsets[i + 1] - offsets[i]);
+        for (auto edge = edges + offsets[i]; edge != edges + offsets[i + 1]; ++edge) {
+            node_edges.push_back(nodes[*edge]);
+        }
+    }
+    return true;
+}
+
+bool Graph::save(const char* file) const {
+    GraphFileHeader header = {GRAPH_FILE_MAGIC, GRAPH_FILE_VERSION, DPA_NDIM, static_cast<uint32_t>(_nodes.size()), 0};
+    std::unordered_map<const Node*, uint32_t> indices;
+    std::vector<float> positions(DPA_NDIM * _nodes.size());
+    std::vector<uint8_t> states;
+    for (auto& [position, node] : _nodes) {
+        copyPosition(&positions[DPA_NDIM * indices.size()], position, std::make_index_sequence<DPA_NDIM>());
+        states.push_back(node->state);
+        indices.emplace(node.get(), indices.size());
+    }
+    std::vector<uint32_t> offsets = {0};
+    std::vector<uint32_t> edges;
+    for (auto& rt_node : _nodes) {
+        for (auto& adj_node : rt_node.second->edges) {
+            auto found = Node::validate(adj_node) ? indices.find(adj_node.get()) : indices.end();
+            if (found != indices.end()) {
+                edges.push_back(found->second);
+            }
+        }
+        offsets.push_back(edges.size());
+    }
+    header.edge_count = edges.size();
+    auto fp = fopen(file, "wb");
+    if (!fp) {
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                   fwrite(positions.data(), sizeof(float), positions.size(), fp) == positions.size() &&
+                   fwrite(offsets.data(), sizeof(uint32_t), offsets.size(), fp) == offsets.size() &&
+                   fwrite(edges.data(), sizeof(uint32_t), edges.size(), fp) == edges.size() &&
+                   fwrite(states.data(), sizeof(uint8_t), states.size(), fp) == states.size();
+    return !fclose(fp) && written;
+}
+
+bool Graph::load(const char* file) {
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat file_stat;
+    void* data = fstat(fd, &file_stat) || !file_stat.st_size
+                         ? MAP_FAILED
+                         : mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    Nodes nodes;
+    bool read = readGraphFile(static_cast<const char*>(data), file_stat.st_size, _auction_context, nodes);
+    munmap(data, file_stat.st_size);
+    if (!read) {
+        return false;
+    }
+    // reject files with duplicate positions, since edges would lead to nodes outside of the graph
+    // nodes are inserted into a separate graph first, so that the current nodes are only replaced on success
+    Graph loaded;
+    if (loaded.insertNodes(nodes) != nodes.size()) {
+        for (auto& node : nodes) {
+            node->edges.clear();
+        }
+        return false;
+    }
+    *this = std::move(loaded);
+    return true;
+}
+
 bool Graph::removeNode(NodePtr node) {
     if (node) {
+        // remove all edges to the node, since searches only skip over deleted nodes
+        // edges may be one way, so every node in the graph is checked rather than just the adjacent ones
+        for (auto& rt_node : _nodes) {
+            auto& edges = rt_node.second->edges;
+            edges.erase(std::remove(edges.begin(), edges.end(), node), edges.end());
+        }
         node->edges.clear();
         node->state = Node::DELETED;
     }
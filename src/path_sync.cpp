@@ -2,17 +2,27 @@
 
 namespace decentralized_path_auction {
 
-static const Auction::Bid* insertBids(const std::string& agent_id, Path::const_iterator it, Path::const_iterator end) {
+static const Auction::Bid* insertBids(
+        Auction::Transaction& transaction, AgentId agent_id, Path::const_iterator it, Path::const_iterator end) {
     Auction::Bid* prev_bid = nullptr;
     for (; it != end; ++it) {
-        if (it->node->auction.insertBid(agent_id, it->price, it->duration, prev_bid)) {
+        if (transaction.insertBid(it->node->auction, agent_id, it->price, it->duration, prev_bid)) {
             return nullptr;
         };
     }
     return prev_bid;
 }
 
-static PathSync::Error removeBids(const std::string& agent_id, Path::const_iterator it, Path::const_iterator end) {
+static PathSync::Error removeBids(
+        Auction::Transaction& transaction, AgentId agent_id, Path::const_iterator it, Path::const_iterator end) {
+    bool error = false;
+    for (; it != end; ++it) {
+        error |= transaction.removeBid(it->node->auction, agent_id, it->price);
+    }
+    return error ? PathSync::VISIT_BID_ALREADY_REMOVED : PathSync::SUCCESS;
+}
+
+static PathSync::Error removeBids(AgentId agent_id, Path::const_iterator it, Path::const_iterator end) {
     bool error = false;
     for (; it != end; ++it) {
         error |= it->node->auction.removeBid(agent_id, it->price);
@@ -20,11 +30,12 @@ static PathSync::Error removeBids(const std::string& agent_id, Path::const_itera
     return error ? PathSync::VISIT_BID_ALREADY_REMOVED : PathSync::SUCCESS;
 }
 
-PathSync::Error PathSync::updatePath(const std::string& agent_id, const Path& path, size_t path_id) {
+PathSync::Error PathSync::updatePath(AgentId agent_id, const Path& path, size_t path_id) {
     // input checks
     if (agent_id.empty()) {
         return AGENT_ID_EMPTY;
     }
+    Auction::WriteLock lock(_auction_mutex.get());
     // check path id
     if (auto found = _paths.find(agent_id);
             found != _paths.end() && path_id <= found->second.path_id && !found->second.path.empty()) {
@@ -40,36 +51,55 @@ PathSync::Error PathSync::updatePath(const std::string& agent_id, const Path& pa
     for (auto& visit : path) {
         auto& bids = visit.node->auction.getBids();
         auto found = bids.find(visit.price);
-        if (found != bids.end() && found->second.bidder != agent_id) {
+        if (found != bids.end() && found->second->bidder != agent_id) {
             return VISIT_PRICE_ALREADY_EXIST;
         }
     }
-    // remove old bids and insert new ones
     auto& info = _paths[agent_id];
-    auto remove_error = removeBids(agent_id, info.path.begin() + info.progress_min, info.path.end());
-    auto tail_bid = insertBids(agent_id, path.begin(), path.end());
+    // unchanged paths with all bids in place keep them, so that other searches don't see bids relinked
+    auto unchanged = [agent_id](const Visit& visit, const Visit& old_visit) {
+        if (visit.node != old_visit.node || visit.price != old_visit.price || visit.duration != old_visit.duration) {
+            return false;
+        }
+        auto& bids = visit.node->auction.getBids();
+        auto found = bids.find(visit.price);
+        return found != bids.end() && found->second->bidder == agent_id;
+    };
+    if (info.progress_min == 0 && std::equal(path.begin(), path.end(), info.path.begin(), info.path.end(), unchanged)) {
+        info.path = path;
+        info.path_id = path_id;
+        info.progress_max = 0;
+        return SUCCESS;
+    }
+    // stage removal of old bids and insertion of new ones
+    thread_local Auction::Transaction transaction;
+    auto remove_error = removeBids(transaction, agent_id, info.path.begin() + info.progress_min, info.path.end());
+    auto tail_bid = insertBids(transaction, agent_id, path.begin(), path.end());
     assert(tail_bid && "insert bid failed");
-    // check if new path causes cycle
+    // check if new path causes cycle, which is only possible if the bid order could not be maintained
     thread_local size_t cycle_nonce = 0;
     thread_local std::vector<CycleVisit> cycle_visits;
     cycle_visits.resize(DenseId<Auction::Bid>::count());
-    if (tail_bid->head().detectCycle(cycle_visits, ++cycle_nonce)) {
+    auto& context = *path.front().node->auction.getContext();
+    if (!context.ordered() && tail_bid->head().detectCycle(cycle_visits, ++cycle_nonce)) {
         // revert bids back to previous path
-        removeBids(agent_id, path.begin(), path.end());
-        insertBids(agent_id, info.path.begin() + info.progress_min, info.path.end());
+        transaction.rollback();
         // remove path entry if it's empty
         if (info.path.empty()) {
             _paths.erase(agent_id);
         }
         return PATH_CAUSES_CYCLE;
     }
-    // update path
-    info = {path, path_id, 0, 0};
+    transaction.commit();
+    // update path in place to reuse its storage
+    info.path = path;
+    info.path_id = path_id;
+    info.progress_min = info.progress_max = 0;
     return remove_error;
 }
 
-PathSync::Error PathSync::updateProgress(
-        const std::string& agent_id, size_t progress_min, size_t progress_max, size_t path_id) {
+PathSync::Error PathSync::updateProgress(AgentId agent_id, size_t progress_min, size_t progress_max, size_t path_id) {
+    Auction::WriteLock lock(_auction_mutex.get());
     // input checks
     auto found = _paths.find(agent_id);
     if (found == _paths.end()) {
@@ -120,18 +150,18 @@ PathSync::Error PathSync::updateProgress(
         auto& auction = path.node->auction;
         auto highest = auction.getHighestBid();
         // claim until agent is no longer highest bidder
-        if (highest->second.bidder != agent_id) {
+        if (highest->second->bidder != agent_id) {
             break;
         }
         // skip already claimed nodes
-        if (highest->first >= FLT_MAX) {
+        if (highest->first >= PRICE_MAX) {
             continue;
         }
-        // claimed nodes with price FLT_MAX
-        if (auction.changeBid(highest->first, FLT_MAX)) {
+        // claimed nodes with infinite price
+        if (auction.changeBid(highest->first, PRICE_MAX)) {
             assert(!"could not change bid");
         }
-        path.price = FLT_MAX;
+        path.price = PRICE_MAX;
     }
     --info.progress_max;
     assert(info.progress_max < info.path.size());
@@ -142,7 +172,8 @@ PathSync::Error PathSync::updateProgress(
     return SUCCESS;
 }
 
-PathSync::Error PathSync::removePath(const std::string& agent_id) {
+PathSync::Error PathSync::removePath(AgentId agent_id) {
+    Auction::WriteLock lock(_auction_mutex.get());
     auto found = _paths.find(agent_id);
     if (found == _paths.end()) {
         return AGENT_ID_NOT_FOUND;
@@ -155,6 +186,7 @@ PathSync::Error PathSync::removePath(const std::string& agent_id) {
 
 PathSync::Error PathSync::clearPaths() {
     int error = SUCCESS;
+    Auction::WriteLock lock(_auction_mutex.get());
     for (auto& [agent_id, info] : _paths) {
         error |= removeBids(agent_id, info.path.begin() + info.progress_min, info.path.end());
     }
@@ -162,7 +194,8 @@ PathSync::Error PathSync::clearPaths() {
     return static_cast<Error>(error);
 }
 
-PathSync::WaitStatus PathSync::checkWaitStatus(const std::string& agent_id) const {
+PathSync::WaitStatus PathSync::checkWaitStatus(AgentId agent_id) const {
+    Auction::ReadLock lock(_auction_mutex.get());
     // find path
     auto found = _paths.find(agent_id);
     if (found == _paths.end()) {
@@ -186,25 +219,25 @@ PathSync::WaitStatus PathSync::checkWaitStatus(const std::string& agent_id) cons
             default:
                 auto& bids = visit.node->auction.getBids();
                 auto bid = bids.find(visit.price);
-                if (bid == bids.end() || bid->second.bidder != agent_id) {
+                if (bid == bids.end() || bid->second->bidder != agent_id) {
                     return {VISIT_BID_ALREADY_REMOVED, progress, FLT_MAX};
                 }
         }
     }
     // calculate remaining duration
-    auto& last_bid = info.path.back().node->auction.getBids().find(info.path.back().price)->second;
+    auto& last_bid = *info.path.back().node->auction.getBids().find(info.path.back().price)->second;
     float prev_wait_duration = last_bid.prev ? last_bid.prev->waitDuration() : 0;
     float higher_wait_duration = last_bid.higher ? last_bid.higher->waitDuration() : 0;
     float remaining_duration = std::max(prev_wait_duration, higher_wait_duration);
     // calculate blocked progress
     size_t progress = info.progress_min;
     while (progress < info.path.size() &&
-            info.path[progress].node->auction.getHighestBid()->second.bidder == agent_id) {
+            info.path[progress].node->auction.getHighestBid()->second->bidder == agent_id) {
         // consider any path with progress_min == progress_max as blocked at that node
         auto& bids = info.path[progress].node->auction.getBids();
         if (progress > info.progress_min && std::any_of(std::next(bids.begin()), bids.end(), [&](const auto& bid) {
-                auto& other_info = _paths.at(bid.second.bidder);
-                return agent_id != bid.second.bidder && other_info.progress_min == other_info.progress_max &&
+                auto& other_info = _paths.at(bid.second->bidder);
+                return agent_id != bid.second->bidder && other_info.progress_min == other_info.progress_max &&
                        info.path[progress].node == other_info.path[other_info.progress_min].node;
             })) {
             break;
@@ -246,8 +279,8 @@ PathSync::Error PathSync::validate(const Path& path) const {
         return DESTINATION_NODE_NO_PARKING;
     }
     // check for duplicate visits
-    std::vector<std::pair<const Node*, float>> unique_buf;
-    unique_buf.reserve(path.size());
+    thread_local std::vector<std::pair<const Node*, Price>> unique_buf;
+    unique_buf.clear();
     for (auto& visit : path) {
         unique_buf.emplace_back(visit.node.get(), visit.price);
     }
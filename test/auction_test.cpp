@@ -1,27 +1,28 @@
 #include <decentralized_path_auction/auction.hpp>
 #include <gtest/gtest.h>
+#include <thread>
 
 using namespace decentralized_path_auction;
 
 static void check_auction_links(const Auction::Bids& bids) {
-    EXPECT_EQ(bids.rbegin()->second.next, nullptr);
-    EXPECT_EQ(bids.begin()->second.lower, nullptr);
-    EXPECT_EQ(bids.begin()->second.next, nullptr);
-    EXPECT_EQ(bids.begin()->second.prev, nullptr);
+    EXPECT_EQ(bids.rbegin()->second->next, nullptr);
+    EXPECT_EQ(bids.begin()->second->lower, nullptr);
+    EXPECT_EQ(bids.begin()->second->next, nullptr);
+    EXPECT_EQ(bids.begin()->second->prev, nullptr);
     size_t i = 0;
-    for (auto bid = &std::next(bids.begin())->second; bid; bid = bid->next, ++i) {
+    for (auto bid = std::next(bids.begin())->second.get(); bid; bid = bid->next, ++i) {
         if (bid->prev) {
             EXPECT_EQ(bid->prev->next, bid);
         } else {
-            EXPECT_EQ(bid, &std::next(bids.begin())->second);
+            EXPECT_EQ(bid, std::next(bids.begin())->second.get());
         }
         if (bid->next) {
             EXPECT_EQ(bid->next->prev, bid);
         } else {
-            EXPECT_EQ(bid, &bids.rbegin()->second);
+            EXPECT_EQ(bid, bids.rbegin()->second.get());
         }
         ASSERT_TRUE(bid->lower);
-        EXPECT_EQ(bid->lower->next, bid->lower == &bids.begin()->second ? nullptr : bid);
+        EXPECT_EQ(bid->lower->next, bid->lower == bids.begin()->second.get() ? nullptr : bid);
         if (bid->higher) {
             EXPECT_EQ(bid->higher->prev, bid);
         }
@@ -35,10 +36,10 @@ TEST(auction, constructor) {
     EXPECT_EQ(auction.getBids().size(), 1u);
     auto& [start_price, start_bid] = *auction.getBids().begin();
     EXPECT_EQ(start_price, 10);
-    EXPECT_EQ(start_bid.bidder, "");
-    EXPECT_EQ(start_bid.prev, nullptr);
-    EXPECT_EQ(start_bid.next, nullptr);
-    EXPECT_EQ(start_bid.lower, nullptr);
+    EXPECT_EQ(start_bid->bidder, "");
+    EXPECT_EQ(start_bid->prev, nullptr);
+    EXPECT_EQ(start_bid->next, nullptr);
+    EXPECT_EQ(start_bid->lower, nullptr);
 }
 
 TEST(auction, destructor) {
@@ -55,14 +56,14 @@ TEST(auction, destructor) {
             }
         }
         for (auto bid = std::next(auc1.getBids().begin()); bid != auc1.getBids().end(); ++bid) {
-            EXPECT_EQ(bid->second.prev, nullptr);
-            EXPECT_EQ(bid->second.next->next, nullptr);
-            EXPECT_EQ(bid->second.next->prev, &bid->second);
+            EXPECT_EQ(bid->second->prev, nullptr);
+            EXPECT_EQ(bid->second->next->next, nullptr);
+            EXPECT_EQ(bid->second->next->prev, bid->second.get());
         }
     }
     for (auto bid = std::next(auc1.getBids().begin()); bid != auc1.getBids().end(); ++bid) {
-        EXPECT_EQ(bid->second.prev, nullptr);
-        EXPECT_EQ(bid->second.next, nullptr);
+        EXPECT_EQ(bid->second->prev, nullptr);
+        EXPECT_EQ(bid->second->next, nullptr);
     }
     EXPECT_EQ(auc1.getBids().size(), 6u);
 }
@@ -78,10 +79,10 @@ TEST(auction, insert_bid) {
     EXPECT_EQ(auction.insertBid("A", 1, -1, prev), Auction::DURATION_NEGATIVE);
     // add first bid
     EXPECT_EQ(auction.insertBid("A", 1, 0, prev), Auction::SUCCESS);
-    EXPECT_EQ(bids.begin()->second.lower, nullptr);
+    EXPECT_EQ(bids.begin()->second->lower, nullptr);
     EXPECT_EQ(prev->prev, nullptr);
     EXPECT_EQ(prev->next, nullptr);
-    EXPECT_EQ(prev->lower, &bids.begin()->second);
+    EXPECT_EQ(prev->lower, bids.begin()->second.get());
     // more rejection checks
     EXPECT_EQ(auction.insertBid("A", 1, 0, prev), Auction::PRICE_ALREADY_EXIST);
     EXPECT_EQ(auction.insertBid("B", 2, 0, prev), Auction::BIDDER_MISMATCH);
@@ -133,7 +134,7 @@ TEST(auction, change_bid) {
         EXPECT_EQ(bid->first, i + 5);
     }
     int count = 0;
-    auto p = &auction.getHighestBid()->second;
+    auto p = auction.getHighestBid()->second.get();
     while (p) {
         p = p->prev;
         ++count;
@@ -161,6 +162,37 @@ TEST(auction, get_higher_bid) {
     EXPECT_EQ(auction.getHigherBid(3, "B"), auction.getBids().end());
 }
 
+TEST(auction, adjacent_prices) {
+    // bids at adjacent prices leave no gap for another bid in between
+    Auction auction(0);
+    Auction::Bid* prev_a = nullptr;
+    Auction::Bid* prev_b = nullptr;
+    Auction::Bid* prev_c = nullptr;
+    EXPECT_EQ(auction.insertBid("A", 1, 0, prev_a), Auction::SUCCESS);
+    EXPECT_EQ(auction.insertBid("B", nextPrice(1), 0, prev_b), Auction::SUCCESS);
+    EXPECT_EQ(auction.getHigherBid(1)->first, nextPrice(1));
+    EXPECT_EQ(auction.getHigherBid(nextPrice(1)), auction.getBids().end());
+    // infinite prices stay infinite
+    EXPECT_EQ(nextPrice(PRICE_MAX), PRICE_MAX);
+    EXPECT_EQ(PRICE_MAX + 1, PRICE_MAX);
+    EXPECT_EQ(auction.insertBid("C", PRICE_MAX, 0, prev_c), Auction::SUCCESS);
+    EXPECT_EQ(auction.getHighestBid()->first, PRICE_MAX);
+}
+
+TEST(auction, price_arithmetic) {
+    // prices behave the same with float and fixed point prices
+    Price price = 2;
+    EXPECT_EQ(++price, 3);
+    EXPECT_EQ(--price, 2);
+    EXPECT_EQ(price *= -3, -6);
+    EXPECT_EQ(price /= 2, -3);
+    EXPECT_EQ(price += 1, -2);
+    EXPECT_EQ(price -= 1, -3);
+    EXPECT_EQ(-price, 3);
+    EXPECT_EQ(static_cast<float>(price), -3);
+    EXPECT_EQ(PRICE_MAX * -1, -PRICE_MAX);
+}
+
 TEST(auction, get_highest_bid) {
     Auction auction(0);
     EXPECT_EQ(auction.getHighestBid()->first, 0);
@@ -179,3 +211,258 @@ TEST(auction, get_highest_bid) {
     EXPECT_EQ(auction.getHighestBid("A")->first, 3);
     EXPECT_EQ(auction.getHighestBid("B")->first, 1);
 }
+
+TEST(auction, stable_bid_handles) {
+    Auction auction(0);
+    std::vector<Auction::Bid*> handles;
+    // insert out of order past the inline capacity of the bid book to force entries to shift and reallocate
+    for (int i = 0; i < 64; ++i) {
+        Auction::Bid* prev = nullptr;
+        EXPECT_EQ(auction.insertBid("A", (i * 37) % 64 + 1, i, prev), Auction::SUCCESS);
+        handles.push_back(prev);
+    }
+    auto& bids = auction.getBids();
+    for (int i = 0; i < 64; ++i) {
+        auto found = bids.find((i * 37) % 64 + 1);
+        EXPECT_EQ(found->second.get(), handles[i]);
+        EXPECT_EQ(found->second->duration, i);
+        EXPECT_EQ(found->second->lower, std::prev(found)->second.get());
+        EXPECT_EQ(std::prev(found)->second->higher, handles[i]);
+    }
+}
+
+TEST(auction, agent_id) {
+    AgentId empty;
+    EXPECT_TRUE(empty.empty());
+    EXPECT_EQ(empty, AgentId(""));
+    EXPECT_EQ(empty.name(), "");
+    AgentId a("fleet-a/robot-0173");
+    AgentId b(std::string("fleet-a/robot-0174"));
+    EXPECT_FALSE(a.empty());
+    EXPECT_NE(a, b);
+    EXPECT_EQ(a, AgentId("fleet-a/robot-0173"));
+    EXPECT_EQ(a.name(), "fleet-a/robot-0173");
+    EXPECT_EQ(b.name(), "fleet-a/robot-0174");
+    // string bidders are interned into the same id
+    Auction auction(0);
+    Auction::Bid* prev = nullptr;
+    EXPECT_EQ(auction.insertBid("fleet-a/robot-0173", 1, 0, prev), Auction::SUCCESS);
+    EXPECT_EQ(prev->bidder, a);
+    EXPECT_EQ(auction.getHighestBid(a)->first, 0);
+    EXPECT_EQ(auction.removeBid(std::string("fleet-a/robot-0173"), 1), Auction::SUCCESS);
+}
+
+TEST(auction, bid_storage_recycled) {
+    Auction auction(0);
+    Auction::Bid* prev = nullptr;
+    EXPECT_EQ(auction.insertBid("A", 1, 0, prev), Auction::SUCCESS);
+    auto bid = prev;
+    EXPECT_EQ(auction.removeBid("A", 1), Auction::SUCCESS);
+    // freed bid storage is reused by the next bid allocated on the same thread
+    prev = nullptr;
+    EXPECT_EQ(auction.insertBid("B", 2, 0, prev), Auction::SUCCESS);
+    EXPECT_EQ(prev, bid);
+    EXPECT_EQ(prev->bidder, "B");
+    EXPECT_EQ(prev->lower, auction.getBids().begin()->second.get());
+}
+
+static void check_auction_neighbors(const Auction::Bids& bids) {
+    for (auto bid = std::next(bids.begin()); bid != bids.end(); ++bid) {
+        EXPECT_EQ(bid->second->lower, std::prev(bid)->second.get());
+        EXPECT_EQ(std::prev(bid)->second->higher, bid->second.get());
+    }
+    EXPECT_EQ(bids.rbegin()->second->higher, nullptr);
+    // run lengths must match consecutive bids from the same bidder
+    for (auto bid = bids.begin(); bid != bids.end(); ++bid) {
+        uint32_t lower_run = 0, higher_run = 0;
+        for (auto it = bid; it != bids.begin() && std::prev(it)->second->bidder == bid->second->bidder; --it) {
+            ++lower_run;
+        }
+        for (auto it = std::next(bid); it != bids.end() && it->second->bidder == bid->second->bidder; ++it) {
+            ++higher_run;
+        }
+        EXPECT_EQ(bid->second->lower_run, lower_run);
+        EXPECT_EQ(bid->second->higher_run, higher_run);
+    }
+}
+
+using BidState = std::tuple<Price, const Auction::Bid*, AgentId, float, Auction::Bid*, Auction::Bid*>;
+
+static std::vector<BidState> save_bids(const std::array<Auction, 4>& auctions) {
+    std::vector<BidState> state;
+    for (auto& auction : auctions) {
+        for (auto& [price, bid] : auction.getBids()) {
+            state.emplace_back(price, bid.get(), bid->bidder, bid->duration, bid->prev, bid->next);
+        }
+    }
+    return state;
+}
+
+TEST(auction, transaction_rollback) {
+    std::array<Auction, 4> auctions;
+    Auction::Bid* prev_a = nullptr;
+    Auction::Bid* prev_b = nullptr;
+    for (size_t i = 0; i < auctions.size(); ++i) {
+        EXPECT_EQ(auctions[i].insertBid("A", 1, 1, prev_a), Auction::SUCCESS);
+        EXPECT_EQ(auctions[i].insertBid("B", 2, 1, prev_b), Auction::SUCCESS);
+    }
+    auto saved = save_bids(auctions);
+    {
+        Auction::Transaction transaction;
+        for (auto& auction : auctions) {
+            EXPECT_EQ(transaction.removeBid(auction, "A", 1), Auction::SUCCESS);
+            EXPECT_EQ(transaction.removeBid(auction, "A", 1), Auction::PRICE_NOT_FOUND);
+        }
+        // removed bids are unlinked but their slots stay in place
+        EXPECT_EQ(auctions[0].getBids().size(), 3u);
+        EXPECT_EQ(auctions[0].getBids().begin()->second->higher, auctions[0].getBids().find(2)->second.get());
+        Auction::Bid* prev = nullptr;
+        EXPECT_EQ(transaction.insertBid(auctions[3], "A", 1, 5, prev), Auction::SUCCESS);
+        EXPECT_EQ(transaction.insertBid(auctions[2], "A", 3, 5, prev), Auction::SUCCESS);
+        EXPECT_EQ(transaction.insertBid(auctions[1], "A", 2, 5, prev), Auction::PRICE_ALREADY_EXIST);
+        transaction.rollback();
+    }
+    EXPECT_EQ(save_bids(auctions), saved);
+    for (auto& auction : auctions) {
+        check_auction_neighbors(auction.getBids());
+    }
+    // transactions are rolled back when destroyed without commit
+    {
+        Auction::Transaction transaction;
+        Auction::Bid* prev = nullptr;
+        EXPECT_EQ(transaction.removeBid(auctions[0], "B", 2), Auction::SUCCESS);
+        EXPECT_EQ(transaction.insertBid(auctions[0], "B", 2, 3, prev), Auction::SUCCESS);
+        EXPECT_EQ(transaction.insertBid(auctions[1], "B", 4, 3, prev), Auction::SUCCESS);
+    }
+    EXPECT_EQ(save_bids(auctions), saved);
+}
+
+TEST(auction, transaction_commit) {
+    std::array<Auction, 4> auctions;
+    Auction::Bid* prev_a = nullptr;
+    Auction::Bid* prev_b = nullptr;
+    for (size_t i = 0; i < auctions.size(); ++i) {
+        EXPECT_EQ(auctions[i].insertBid("A", 1, 1, prev_a), Auction::SUCCESS);
+        EXPECT_EQ(auctions[i].insertBid("B", 2, 1, prev_b), Auction::SUCCESS);
+    }
+    Auction::Transaction transaction;
+    for (auto& auction : auctions) {
+        EXPECT_EQ(transaction.removeBid(auction, "A", 1), Auction::SUCCESS);
+    }
+    // reverse path of A with some visits at the same price as before
+    prev_a = nullptr;
+    for (size_t i = auctions.size(); i-- > 0;) {
+        EXPECT_EQ(transaction.insertBid(auctions[i], "A", i % 2 ? 1 : 3, 2, prev_a), Auction::SUCCESS);
+    }
+    transaction.commit();
+    for (size_t i = 0; i < auctions.size(); ++i) {
+        auto& bids = auctions[i].getBids();
+        EXPECT_EQ(bids.size(), 3u);
+        EXPECT_EQ(bids.count(i % 2 ? 1 : 3), 1u);
+        check_auction_neighbors(bids);
+    }
+    auto head = auctions[3].getBids().find(1)->second.get();
+    EXPECT_EQ(head->prev, nullptr);
+    EXPECT_EQ(head->duration, 2);
+    EXPECT_EQ(head->next, auctions[2].getBids().find(3)->second.get());
+    EXPECT_EQ(head->next->next->next, prev_a);
+    EXPECT_EQ(prev_a, auctions[0].getBids().find(3)->second.get());
+    // rollback after commit has no effect
+    transaction.rollback();
+    EXPECT_EQ(auctions[0].getBids().count(3), 1u);
+}
+
+TEST(auction, stacked_bid_runs) {
+    Auction auction(0);
+    std::array<AgentId, 3> bidders = {"A", "B", "C"};
+    srand(0);
+    for (int i = 0; i < 1000; ++i) {
+        float price = 1 + rand() % 30;
+        auto bidder = bidders[rand() % bidders.size()];
+        Auction::Bid* prev = nullptr;
+        if (auction.insertBid(bidder, price, 0, prev) == Auction::PRICE_ALREADY_EXIST) {
+            auction.removeBid(auction.getBids().find(price)->second->bidder, price);
+        }
+        check_auction_neighbors(auction.getBids());
+        // compare against a linear scan past the excluded bidder
+        auto& bids = auction.getBids();
+        auto highest = std::prev(bids.end());
+        while (highest != bids.begin() && highest->second->bidder == bidder) {
+            --highest;
+        }
+        EXPECT_EQ(auction.getHighestBid(bidder), highest);
+        auto higher = bids.upper_bound(price);
+        while (higher != bids.end() && higher->second->bidder == bidder) {
+            ++higher;
+        }
+        EXPECT_EQ(auction.getHigherBid(price, bidder), higher);
+    }
+}
+
+TEST(auction, transaction_bid_runs) {
+    Auction auction(0);
+    Auction::Bid* prev = nullptr;
+    for (int i = 1; i <= 5; ++i) {
+        EXPECT_EQ(auction.insertBid(i == 3 ? "B" : "A", i, 0, prev), Auction::SUCCESS);
+        prev = nullptr;
+    }
+    auto& bids = auction.getBids();
+    // bids left unlinked by an open transaction are still skipped past correctly
+    {
+        Auction::Transaction transaction;
+        EXPECT_EQ(transaction.removeBid(auction, "B", 3), Auction::SUCCESS);
+        EXPECT_EQ(auction.getHigherBid(0, "A"), bids.find(3));
+        EXPECT_EQ(auction.getHighestBid("A"), bids.find(3));
+        EXPECT_EQ(transaction.removeBid(auction, "A", 5), Auction::SUCCESS);
+        EXPECT_EQ(transaction.insertBid(auction, "A", 3, 0, prev), Auction::SUCCESS);
+        EXPECT_EQ(auction.getHigherBid(0, "A"), bids.end());
+        EXPECT_EQ(auction.getHighestBid("A"), bids.begin());
+    }
+    check_auction_neighbors(bids);
+    EXPECT_EQ(auction.getHigherBid(0, "A"), bids.find(3));
+    EXPECT_EQ(auction.getHighestBid("A"), bids.find(3));
+    {
+        Auction::Transaction transaction;
+        EXPECT_EQ(transaction.removeBid(auction, "B", 3), Auction::SUCCESS);
+        transaction.commit();
+    }
+    check_auction_neighbors(bids);
+    EXPECT_EQ(auction.getHigherBid(0, "A"), bids.end());
+    EXPECT_EQ(auction.getHighestBid("A"), bids.begin());
+}
+
+TEST(auction, read_write_lock) {
+    Auction auction(0);
+    Auction::Mutex mutex;
+    Auction::ReadLock read_lock(&mutex);
+    size_t version = read_lock.version();
+    // nothing to yield to without waiting writers
+    EXPECT_FALSE(read_lock.yield());
+    EXPECT_EQ(read_lock.version(), version);
+    // writers wait for readers to yield
+    std::thread writer([&auction, &mutex]() {
+        Auction::WriteLock write_lock(&mutex);
+        Auction::Bid* prev = nullptr;
+        EXPECT_EQ(auction.insertBid("A", 1, 0, prev), Auction::SUCCESS);
+    });
+    while (!read_lock.yield()) {
+        std::this_thread::yield();
+    }
+    EXPECT_EQ(auction.getHighestBid()->first, 1);
+    EXPECT_GT(read_lock.version(), version);
+    // writers on other mutexes and writers without a mutex don't wait for readers
+    {
+        Auction::Mutex other_mutex;
+        Auction::WriteLock other_write_lock(&other_mutex);
+        Auction::WriteLock unguarded_write_lock(nullptr);
+    }
+    EXPECT_FALSE(read_lock.yield());
+    read_lock.unlock();
+    writer.join();
+    // versions advance once a writer is done
+    version = Auction::ReadLock(&mutex).version();
+    {
+        Auction::WriteLock write_lock(&mutex);
+    }
+    EXPECT_EQ(Auction::ReadLock(&mutex).version(), version + 1);
+}
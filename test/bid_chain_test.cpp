@@ -1,10 +1,13 @@
 #include <decentralized_path_auction/auction.hpp>
 #include <gtest/gtest.h>
+#include <thread>
 
 using namespace decentralized_path_auction;
 
 TEST(bid_chain, dense_id) {
+    // ids freed by earlier runs of the test are reclaimed so that numbering starts from zero
     struct T {};
+    ASSERT_EQ(DenseId<T>::compact(), 0u);
     std::vector<DenseId<T>> ids(200);
     for (size_t i = 0; i < ids.size(); ++i) {
         ASSERT_EQ(i, ids[i]);
@@ -13,14 +16,115 @@ TEST(bid_chain, dense_id) {
     for (size_t i = 0; i < ids.size(); ++i) {
         ASSERT_EQ(i, ids[i]);
     }
-    ids.resize(100);
-    for (size_t i = 0; i < ids.size(); ++i) {
-        ASSERT_EQ(i, ids[i]);
+    // released ids are reused before new ones are numbered
+    ids.resize(200);
+    std::vector<bool> taken(200);
+    for (auto& id : ids) {
+        ASSERT_LT(id, taken.size());
+        ASSERT_FALSE(taken[id]);
+        taken[id] = true;
+    }
+    EXPECT_EQ(DenseId<T>::count(), 200u);
+    // the most recently released id is reused first
+    struct U {};
+    ASSERT_EQ(DenseId<U>::compact(), 0u);
+    std::array<DenseId<U>, 3> other_ids;
+    other_ids[0].release();
+    other_ids[1].release();
+    DenseId<U> id;
+    other_ids[1].acquire();
+    other_ids[0].acquire();
+    EXPECT_EQ(id, 1u);
+    EXPECT_EQ(other_ids[1], 0u);
+    EXPECT_EQ(other_ids[0], 3u);
+    EXPECT_EQ(other_ids[2], 2u);
+    EXPECT_EQ(DenseId<U>::count(), 4u);
+}
+
+TEST(bid_chain, dense_id_compact) {
+    struct T {};
+    ASSERT_EQ(DenseId<T>::compact(), 0u);
+    std::vector<DenseId<T>> ids(10);
+    // only the highest free ids can be reclaimed
+    ids[1].release();
+    ids.resize(6);
+    EXPECT_EQ(DenseId<T>::count(), 10u);
+    EXPECT_EQ(DenseId<T>::compact(), 6u);
+    ids[5].release();
+    ids[4].release();
+    EXPECT_EQ(DenseId<T>::compact(), 4u);
+    // remaining free ids are still reused
+    ids[4].acquire();
+    EXPECT_EQ(ids[4], 1u);
+    EXPECT_EQ(DenseId<T>::count(), 4u);
+}
+
+TEST(bid_chain, dense_id_threads) {
+    struct T {};
+    std::vector<std::vector<DenseId<T>>> ids(4);
+    std::vector<std::thread> threads;
+    for (auto& thread_ids : ids) {
+        threads.emplace_back([&thread_ids]() {
+            for (int i = 0; i < 1000; ++i) {
+                thread_ids.resize(rand() % 300);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    // ids held across threads remain unique and dense
+    std::vector<bool> taken(DenseId<T>::count());
+    size_t live_count = 0;
+    for (auto& thread_ids : ids) {
+        for (auto& id : thread_ids) {
+            ASSERT_LT(id, taken.size());
+            ASSERT_FALSE(taken[id]);
+            taken[id] = true;
+        }
+        live_count += thread_ids.size();
+    }
+    EXPECT_LE(DenseId<T>::count(), live_count + 4 * 300);
+    // ids cached by exited threads are handed back, so releasing all ids reclaims everything
+    ids.clear();
+    EXPECT_EQ(DenseId<T>::compact(), 0u);
+}
+
+TEST(bid_chain, dense_id_threads_unique) {
+    // threads keep so few ids that the number of live ids drops to zero over and over
+    struct T {};
+    std::array<std::atomic<int>, 4096> owners = {};
+    std::atomic<bool> duplicate = false;
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < 4; ++thread) {
+        threads.emplace_back([&]() {
+            std::vector<DenseId<T>> ids;
+            for (int i = 0; i < 20000; ++i) {
+                for (auto& id : ids) {
+                    --owners[id];
+                }
+                ids.resize(rand() % 3);
+                for (auto& id : ids) {
+                    ASSERT_LT(id, owners.size());
+                    if (owners[id]++) {
+                        duplicate = true;
+                    }
+                }
+            }
+            for (auto& id : ids) {
+                --owners[id];
+            }
+        });
     }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_FALSE(duplicate);
+    EXPECT_EQ(DenseId<T>::compact(), 0u);
 }
 
 TEST(bid_chain, wait_duration) {
-    std::array<Auction, 10> auctions = {0};
+    std::array<Auction, 10> auctions;
     Auction::Bid* prev = nullptr;
     for (size_t i = 1; i < auctions.size(); ++i) {
         EXPECT_EQ(auctions[i].insertBid("A", i, 1, prev), Auction::SUCCESS);
@@ -28,12 +132,297 @@ TEST(bid_chain, wait_duration) {
     prev = nullptr;
     EXPECT_EQ(auctions[5].insertBid("b", 100, 100, prev), Auction::SUCCESS);
     for (size_t i = 0; i < auctions.size(); ++i) {
-        EXPECT_EQ(auctions[i].getBids().begin()->second.waitDuration(), i + (i >= 5) * 95);
+        EXPECT_EQ(auctions[i].getBids().begin()->second->waitDuration(), i + (i >= 5) * 95);
+    }
+}
+
+TEST(bid_chain, wait_duration_cached) {
+    std::array<Auction, 3> auctions;
+    Auction::Bid* prev = nullptr;
+    for (size_t i = 0; i < auctions.size(); ++i) {
+        EXPECT_EQ(auctions[i].insertBid("A", 1, 2, prev), Auction::SUCCESS);
     }
+    auto start = auctions[2].getBids().begin()->second.get();
+    EXPECT_EQ(start->waitDuration(), 6);
+    EXPECT_EQ(start->waitDuration(), 6);
+    EXPECT_EQ(start->waitDuration("A"), 0);
+    // cached durations are invalidated by bid changes
+    prev = nullptr;
+    EXPECT_EQ(auctions[0].insertBid("B", 2, 10, prev), Auction::SUCCESS);
+    EXPECT_EQ(start->waitDuration(), 14);
+    EXPECT_EQ(start->waitDuration("A"), 0);
+    EXPECT_EQ(auctions[1].removeBid("A", 1), Auction::SUCCESS);
+    EXPECT_EQ(start->waitDuration(), 12);
+    // cycles remain infinite when cached
+    prev = auctions[2].getBids().find(1)->second.get();
+    EXPECT_EQ(auctions[2].insertBid("A", 2, 0, prev), Auction::SUCCESS);
+    EXPECT_EQ(start->waitDuration(), FLT_MAX);
+    EXPECT_EQ(start->waitDuration(), FLT_MAX);
+}
+
+TEST(bid_chain, wait_duration_context) {
+    Auction a(0, std::make_shared<Auction::Context>());
+    Auction b(0, std::make_shared<Auction::Context>());
+    auto version = b.getContext()->version();
+    EXPECT_NE(a.getContext()->version(), version);
+    Auction::Bid* prev = nullptr;
+    EXPECT_EQ(a.insertBid("A", 1, 5, prev), Auction::SUCCESS);
+    auto id = size_t(prev->id);
+    EXPECT_EQ(prev->waitDuration(), 5);
+    // changes only advance the version of their own context
+    EXPECT_EQ(b.getContext()->version(), version);
+    // the id freed in one context and taken in another doesn't return the duration cached for the previous bid
+    EXPECT_EQ(a.removeBid("A", 1), Auction::SUCCESS);
+    prev = nullptr;
+    EXPECT_EQ(b.insertBid("B", 1, 7, prev), Auction::SUCCESS);
+    EXPECT_EQ(size_t(prev->id), id);
+    EXPECT_EQ(prev->waitDuration(), 7);
+}
+
+// recursive formulation of cycle detection as reference
+static bool detect_cycle_recursive(
+        const Auction::Bid& bid, std::vector<CycleVisit>& visits, size_t nonce, AgentId exclude_bidder) {
+    if (visits[bid.id].nonce == nonce) {
+        return visits[bid.id].in_cycle;
+    }
+    visits[bid.id].nonce = nonce;
+    visits[bid.id].in_cycle = 1;
+    auto next = bid.next;
+    bool next_temp = next && visits[next->id].in_cycle >> 1 && visits[next->id].nonce == nonce;
+    return (visits[bid.id].in_cycle =
+                    (bid.lower && detect_cycle_recursive(*bid.lower, visits, nonce, exclude_bidder)) ||
+                    (bid.bidder != exclude_bidder &&
+                            ((bid.prev && bid.prev->lower &&
+                                     detect_cycle_recursive(*bid.prev->lower, visits, nonce, exclude_bidder)) ||
+                                    (next && (visits[next->id].nonce -= next_temp,
+                                                     detect_cycle_recursive(*next, visits, nonce, exclude_bidder),
+                                                     (visits[next->id].in_cycle |= next_temp << 1) & 1)))));
+}
+
+TEST(bid_chain, detect_cycle_matches_recursive) {
+    std::array<Auction, 6> auctions;
+    std::array<AgentId, 4> bidders = {"A", "B", "C", "D"};
+    srand(1);
+    for (int path = 0; path < 40; ++path) {
+        Auction::Bid* prev = nullptr;
+        for (int i = rand() % 6; i >= 0; --i) {
+            auctions[rand() % auctions.size()].insertBid(bidders[path % bidders.size()], 1 + rand() % 20, 0, prev);
+        }
+    }
+    std::vector<const Auction::Bid*> bids;
+    for (auto& auction : auctions) {
+        for (auto& bid : auction.getBids()) {
+            bids.push_back(bid.second.get());
+        }
+    }
+    std::vector<CycleVisit> visits(DenseId<Auction::Bid>::count());
+    size_t nonce = 0;
+    for (int i = 0; i < 2000; ++i) {
+        ++nonce;
+        // mark some bids as temporary like path search does for ancestor visits
+        for (int j = rand() % 4; j > 0; --j) {
+            visits[bids[rand() % bids.size()]->id] = {nonce, 2};
+        }
+        auto expected_visits = visits;
+        auto& bid = *bids[rand() % bids.size()];
+        auto exclude_bidder = rand() % 2 ? bidders[rand() % bidders.size()] : AgentId();
+        bool expected = detect_cycle_recursive(bid, expected_visits, nonce, exclude_bidder);
+        ASSERT_EQ(bid.detectCycle(visits, nonce, exclude_bidder), expected);
+        for (size_t j = 0; j < visits.size(); ++j) {
+            ASSERT_EQ(visits[j].nonce, expected_visits[j].nonce);
+            ASSERT_EQ(visits[j].in_cycle, expected_visits[j].in_cycle);
+        }
+    }
+}
+
+TEST(bid_chain, detect_cycle_ancestor_nonce) {
+    std::array<Auction, 6> auctions;
+    std::array<AgentId, 4> bidders = {"A", "B", "C", "D"};
+    srand(2);
+    for (int path = 0; path < 40; ++path) {
+        Auction::Bid* prev = nullptr;
+        for (int i = rand() % 6; i >= 0; --i) {
+            auctions[rand() % auctions.size()].insertBid(bidders[path % bidders.size()], 1 + rand() % 20, 0, prev);
+        }
+    }
+    std::vector<const Auction::Bid*> bids;
+    for (auto& auction : auctions) {
+        for (auto& bid : auction.getBids()) {
+            bids.push_back(bid.second.get());
+        }
+    }
+    std::vector<CycleVisit> visits(DenseId<Auction::Bid>::count());
+    std::vector<CycleVisit> expected_visits(DenseId<Auction::Bid>::count());
+    size_t nonce = 0;
+    for (int i = 0; i < 100; ++i) {
+        // ancestors are marked once for many queries instead of for each query
+        std::vector<const Auction::Bid*> ancestors;
+        for (int j = rand() % 4; j > 0; --j) {
+            ancestors.push_back(bids[rand() % bids.size()]);
+        }
+        size_t ancestor_nonce = ++nonce;
+        for (auto ancestor : ancestors) {
+            visits[ancestor->id] = {ancestor_nonce, 2};
+        }
+        for (int j = 0; j < 20; ++j) {
+            ++nonce;
+            for (auto ancestor : ancestors) {
+                expected_visits[ancestor->id] = {nonce, 2};
+            }
+            auto& bid = *bids[rand() % bids.size()];
+            auto exclude_bidder = rand() % 2 ? bidders[rand() % bidders.size()] : AgentId();
+            bool expected = bid.detectCycle(expected_visits, nonce, exclude_bidder);
+            ASSERT_EQ(bid.detectCycle(visits, nonce, exclude_bidder, nullptr, ancestor_nonce), expected);
+        }
+    }
+}
+
+TEST(bid_chain, detect_cycle_deep) {
+    // long chains of lower bids must not exhaust the call stack
+    Auction auction(0);
+    const int depth = 300000;
+    for (int i = 1; i <= depth; ++i) {
+        Auction::Bid* prev = nullptr;
+        ASSERT_EQ(auction.insertBid(i % 2 ? "A" : "B", i, 0, prev), Auction::SUCCESS);
+    }
+    std::vector<CycleVisit> visits(DenseId<Auction::Bid>::count());
+    auto top = auction.getBids().rbegin()->second.get();
+    EXPECT_FALSE(top->detectCycle(visits, 1));
+    // extending the lowest bid's path above all other bids closes a cycle
+    auto prev = auction.getBids().find(1)->second.get();
+    ASSERT_EQ(auction.insertBid("A", depth + 1, 0, prev), Auction::SUCCESS);
+    visits.resize(DenseId<Auction::Bid>::count());
+    EXPECT_TRUE(prev->detectCycle(visits, 2));
+}
+
+// every bid must be ordered before the bids it links to while no bids are unordered
+template <class Auctions>
+void check_bid_order(const Auctions& auctions) {
+    if (!auctions.begin()->getContext()->ordered()) {
+        return;
+    }
+    for (auto& auction : auctions) {
+        for (auto& [price, bid] : auction.getBids()) {
+            if (!bid->lower) {
+                continue;
+            }
+            ASSERT_FALSE(bid->unordered);
+            ASSERT_TRUE(bid->orderedBefore(*bid->lower));
+            if (bid->prev && bid->prev->lower) {
+                ASSERT_TRUE(bid->orderedBefore(*bid->prev->lower));
+            }
+            if (bid->next) {
+                ASSERT_TRUE(bid->orderedBefore(*bid->next));
+            }
+        }
+    }
+}
+
+TEST(bid_chain, bid_order) {
+    std::array<Auction, 6> auctions;
+    std::array<AgentId, 4> bidders = {"A", "B", "C", "D"};
+    std::vector<CycleVisit> visits;
+    size_t nonce = 0;
+    srand(2);
+    for (int i = 0; i < 500; ++i) {
+        auto& auction = auctions[rand() % auctions.size()];
+        auto& bidder = bidders[rand() % bidders.size()];
+        if (rand() % 3 && auction.getBids().size() > 1) {
+            auto bid = std::next(auction.getBids().begin(), 1 + rand() % (auction.getBids().size() - 1));
+            ASSERT_EQ(auction.removeBid(bid->second->bidder, bid->first), Auction::SUCCESS);
+        } else {
+            // extend the path of a random bid in another auction
+            auto& other = auctions[rand() % auctions.size()].getBids();
+            auto prev = std::next(other.begin(), rand() % other.size())->second.get();
+            if (!prev->lower || prev->next) {
+                prev = nullptr;
+            }
+            auction.insertBid(prev ? prev->bidder : bidder, 1 + rand() % 20, 0, prev);
+        }
+        check_bid_order(auctions);
+        // bids can't form a cycle while ordered
+        if (auctions[0].getContext()->ordered()) {
+            visits.resize(DenseId<Auction::Bid>::count());
+            for (auto& other : auctions) {
+                for (auto& bid : other.getBids()) {
+                    ASSERT_FALSE(bid.second->detectCycle(visits, ++nonce));
+                }
+            }
+        }
+    }
+    // unordered bids are cleared once removed
+    for (auto& auction : auctions) {
+        auction.clearBids(0);
+    }
+    EXPECT_TRUE(auctions[0].getContext()->ordered());
+}
+
+TEST(bid_chain, bid_order_cycle) {
+    std::array<Auction, 2> auctions;
+    Auction::Bid* prev_a = nullptr;
+    Auction::Bid* prev_b = nullptr;
+    EXPECT_EQ(auctions[0].insertBid("A", 2, 0, prev_a), Auction::SUCCESS);
+    EXPECT_EQ(auctions[1].insertBid("A", 1, 0, prev_a), Auction::SUCCESS);
+    EXPECT_EQ(auctions[0].insertBid("B", 1, 0, prev_b), Auction::SUCCESS);
+    EXPECT_TRUE(auctions[0].getContext()->ordered());
+    check_bid_order(auctions);
+    auto saved = prev_b->order;
+    // closing a cycle within a transaction leaves bids unordered until rolled back
+    {
+        Auction::Transaction transaction;
+        auto prev = prev_b;
+        EXPECT_EQ(transaction.insertBid(auctions[1], "B", 2, 0, prev), Auction::SUCCESS);
+        EXPECT_FALSE(auctions[0].getContext()->ordered());
+    }
+    EXPECT_TRUE(auctions[0].getContext()->ordered());
+    EXPECT_EQ(prev_b->order, saved);
+    check_bid_order(auctions);
+    // removing a bid of the cycle restores the order
+    EXPECT_EQ(auctions[1].insertBid("B", 2, 0, prev_b), Auction::SUCCESS);
+    EXPECT_FALSE(auctions[0].getContext()->ordered());
+    EXPECT_EQ(auctions[1].removeBid("B", 2), Auction::SUCCESS);
+    EXPECT_TRUE(auctions[0].getContext()->ordered());
+    check_bid_order(auctions);
+    // paths in the same direction remain ordered
+    prev_a = prev_a->prev;
+    prev_b = nullptr;
+    EXPECT_EQ(auctions[1].removeBid("A", 1), Auction::SUCCESS);
+    EXPECT_EQ(auctions[0].insertBid("B", 3, 0, prev_b), Auction::SUCCESS);
+    EXPECT_EQ(auctions[1].insertBid("B", 3, 0, prev_b), Auction::SUCCESS);
+    EXPECT_EQ(auctions[1].insertBid("A", 1, 0, prev_a), Auction::SUCCESS);
+    EXPECT_TRUE(auctions[0].getContext()->ordered());
+    check_bid_order(auctions);
+}
+
+TEST(bid_chain, bid_order_context) {
+    auto context = std::make_shared<Auction::Context>();
+    std::array<Auction, 2> auctions = {Auction(0, context), Auction(0, context)};
+    std::array<Auction, 2> others;
+    EXPECT_EQ(auctions[0].getContext(), context);
+    EXPECT_EQ(others[0].getContext(), Auction::Context::global());
+    // a cycle closed in one context leaves auctions of other contexts ordered
+    Auction::Bid* prev_a = nullptr;
+    Auction::Bid* prev_b = nullptr;
+    EXPECT_EQ(auctions[0].insertBid("A", 2, 0, prev_a), Auction::SUCCESS);
+    EXPECT_EQ(auctions[1].insertBid("A", 1, 0, prev_a), Auction::SUCCESS);
+    EXPECT_EQ(auctions[0].insertBid("B", 1, 0, prev_b), Auction::SUCCESS);
+    EXPECT_EQ(auctions[1].insertBid("B", 2, 0, prev_b), Auction::SUCCESS);
+    EXPECT_FALSE(context->ordered());
+    EXPECT_TRUE(Auction::Context::global()->ordered());
+    Auction::Bid* prev_c = nullptr;
+    EXPECT_EQ(others[0].insertBid("C", 1, 0, prev_c), Auction::SUCCESS);
+    EXPECT_EQ(others[1].insertBid("C", 1, 0, prev_c), Auction::SUCCESS);
+    EXPECT_TRUE(Auction::Context::global()->ordered());
+    check_bid_order(others);
+    // clearing bids keeps the context
+    auctions[1].clearBids(0);
+    EXPECT_EQ(auctions[1].getContext(), context);
+    EXPECT_TRUE(context->ordered());
+    check_bid_order(auctions);
 }
 
 TEST(bid_chain, detect_cycle) {
-    std::vector<CycleVisit> visited(100);
+    std::vector<CycleVisit> visited(DenseId<Auction::Bid>::count() + 100);
     size_t cycle_nonce = 0;
     {
         Auction auction(0);
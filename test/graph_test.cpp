@@ -1,5 +1,6 @@
 #include <decentralized_path_auction/graph.hpp>
 #include <gtest/gtest.h>
+#include <unistd.h>
 
 using namespace decentralized_path_auction;
 
@@ -115,6 +116,31 @@ TEST(graph, insert_node) {
     ASSERT_EQ(graph.getNodes().size(), 1u);
 }
 
+TEST(graph, insert_nodes) {
+    Graph graph;
+    ASSERT_TRUE(graph.insertNode(Point{0, 0}));
+    NodePtr first(new Node{{1, 1}});
+    NodePtr duplicate(new Node{{1, 1}});
+    NodePtr taken(new Node{{0, 0}});
+    NodePtr deleted(new Node{{2, 2}, Node::DELETED});
+    Nodes nodes = {first, duplicate, taken, deleted, nullptr};
+    for (int i = 3; i < 100; ++i) {
+        nodes.emplace_back(new Node{{static_cast<float>(i), static_cast<float>(-i)}});
+    }
+    // only valid nodes at new positions are inserted, and the first of duplicates is kept
+    ASSERT_EQ(graph.insertNodes(nodes), 98u);
+    ASSERT_EQ(graph.getNodes().size(), 99u);
+    EXPECT_EQ(graph.findNode({1, 1}), first);
+    EXPECT_NE(graph.findNode({0, 0}), taken);
+    EXPECT_FALSE(graph.findNode({2, 2}));
+    for (int i = 3; i < 100; ++i) {
+        EXPECT_TRUE(graph.findNode({static_cast<float>(i), static_cast<float>(-i)}));
+    }
+    // nothing new to insert
+    ASSERT_EQ(graph.insertNodes(nodes), 0u);
+    ASSERT_EQ(graph.getNodes().size(), 99u);
+}
+
 TEST(graph, remove_node) {
     Graph graph;
     // null check
@@ -134,6 +160,13 @@ TEST(graph, remove_node) {
     ASSERT_EQ(node.use_count(), 1);
     // all nodes removed
     ASSERT_TRUE(graph.getNodes().empty());
+    // one way edges to a removed node are removed as well
+    auto from = graph.insertNode(Point{1, 0});
+    auto to = graph.insertNode(Point{2, 0});
+    from->edges.push_back(to);
+    ASSERT_TRUE(graph.removeNode(to));
+    ASSERT_TRUE(from->edges.empty());
+    ASSERT_EQ(to.use_count(), 1);
 }
 
 TEST(graph, find_node) {
@@ -142,6 +175,31 @@ TEST(graph, find_node) {
     ASSERT_TRUE(graph.insertNode(Point{0, 0}));
     EXPECT_TRUE(graph.findNode({0, 0}));
     EXPECT_TRUE(graph.findNode({0, 0}));
+    // negative zero is the same position
+    EXPECT_TRUE(graph.findNode({-0.0f, 0}));
+    EXPECT_FALSE(graph.insertNode(Point{-0.0f, -0.0f}));
+}
+
+TEST(graph, find_node_after_removals) {
+    Graph graph;
+    Nodes nodes;
+    for (int i = 0; i < 1000; ++i) {
+        nodes.push_back(graph.insertNode(Point{static_cast<float>(i % 37), static_cast<float>(i / 37)}));
+        ASSERT_TRUE(nodes.back());
+    }
+    // remove every third node, which moves colliding entries of the position index
+    for (size_t i = 0; i < nodes.size(); i += 3) {
+        ASSERT_TRUE(graph.removeNode(nodes[i]));
+        ASSERT_FALSE(graph.removeNode(nodes[i]));
+    }
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        auto position = nodes[i]->position;
+        EXPECT_EQ(graph.findNode(position), i % 3 ? nodes[i] : nullptr);
+        EXPECT_EQ(graph.containsNode(nodes[i]), i % 3 != 0);
+    }
+    // removed positions can be taken again
+    ASSERT_TRUE(graph.insertNode(nodes[0]->position));
+    EXPECT_EQ(graph.getNodes().size(), 667u);
 }
 
 TEST(graph, find_nearest_node) {
@@ -178,3 +236,238 @@ TEST(graph, validate_node) {
     EXPECT_FALSE(Node::validate(node));
     EXPECT_FALSE(Node::validate(nullptr));
 }
+
+TEST(graph, compact_graph) {
+    Graph graph;
+    Nodes nodes;
+    make_pathway(graph, nodes, {0, 0}, {4, 0}, 5);
+    // loopback and deleted edges are dropped, nodes outside of the graph are included
+    NodePtr outside(new Node{{0, 1}});
+    nodes[0]->edges.push_back(nodes[0]);
+    nodes[0]->edges.push_back(outside);
+    ASSERT_TRUE(graph.removeNode(nodes[4]));
+    nodes[3]->edges.push_back(nodes[4]);
+    auto compact_graph = graph.freeze();
+    ASSERT_EQ(compact_graph->size(), 5u);
+    EXPECT_EQ(compact_graph->findIndex(nodes[4].get()), CompactGraph::NONE);
+    EXPECT_EQ(compact_graph->findIndex(nullptr), CompactGraph::NONE);
+    for (auto& node : nodes) {
+        auto index = compact_graph->findIndex(node.get());
+        if (index == CompactGraph::NONE) {
+            continue;
+        }
+        EXPECT_EQ(compact_graph->getNode(index), node);
+        Nodes edges;
+        for (auto& adj_node : compact_graph->getEdges(index)) {
+            edges.push_back(adj_node);
+        }
+        Nodes expected;
+        std::copy_if(node->edges.begin(), node->edges.end(), std::back_inserter(expected),
+                [&node](const NodePtr& adj_node) { return Node::validate(adj_node) && adj_node != node; });
+        EXPECT_EQ(edges, expected);
+    }
+    auto index = compact_graph->findIndex(outside.get());
+    ASSERT_NE(index, CompactGraph::NONE);
+    EXPECT_EQ(compact_graph->getEdges(index).size(), 0u);
+    // reverse edges lead back to each node with an edge to it
+    Nodes reverse_edges;
+    for (auto& adj_node : compact_graph->getReverseEdges(index)) {
+        reverse_edges.push_back(adj_node);
+    }
+    EXPECT_EQ(reverse_edges, Nodes{nodes[0]});
+    reverse_edges.clear();
+    for (auto& adj_node : compact_graph->getReverseEdges(compact_graph->findIndex(nodes[2].get()))) {
+        reverse_edges.push_back(adj_node);
+    }
+    EXPECT_EQ(reverse_edges, (Nodes{nodes[1], nodes[3]}));
+}
+
+TEST(graph, compact_graph_travel_times) {
+    Graph graph;
+    Nodes nodes;
+    make_pathway(graph, nodes, {0, 0}, {4, 0}, 5);
+    // travel time doubles through no parking nodes, and turning back costs extra
+    auto travel_time = [](const NodePtr& prev, const NodePtr& cur, const NodePtr& next) {
+        float scale = cur->state == Node::NO_PARKING ? 2 : 1;
+        return scale * (bg::distance(cur->position, next->position) + (prev == next ? 10 : 0));
+    };
+    EXPECT_EQ(graph.freeze()->getTravelTimes(0, nullptr), nullptr);
+    auto compact_graph = graph.freeze(travel_time);
+    auto index = compact_graph->findIndex(nodes[2].get());
+    ASSERT_NE(index, CompactGraph::NONE);
+    // travel times are ordered by edges, with prev being null or adjacent
+    auto check = [&](const NodePtr& prev) {
+        auto travel_times = compact_graph->getTravelTimes(index, prev.get());
+        ASSERT_NE(travel_times, nullptr);
+        size_t edge = 0;
+        for (auto& next : compact_graph->getEdges(index)) {
+            EXPECT_EQ(travel_times[edge++], travel_time(prev, nodes[2], next));
+        }
+    };
+    check(nullptr);
+    check(nodes[1]);
+    check(nodes[3]);
+    EXPECT_EQ(compact_graph->getTravelTimes(index, nodes[4].get()), nullptr);
+    // cached travel times are stale until updated
+    nodes[2]->state = Node::NO_PARKING;
+    EXPECT_EQ(compact_graph->getTravelTimes(index, nullptr)[0], 1);
+    compact_graph->updateTravelTimes(nodes[2].get());
+    check(nullptr);
+    check(nodes[1]);
+    check(nodes[3]);
+}
+
+TEST(graph, landmarks) {
+    Graph graph;
+    Nodes nodes;
+    make_pathway(graph, nodes, {0, 0}, {4, 0}, 5);
+    // one way edge from a node outside of the line
+    NodePtr outside(new Node{{-1, 0}});
+    outside->edges.push_back(nodes[0]);
+    ASSERT_TRUE(graph.insertNode(outside));
+    auto compact_graph = graph.freeze();
+    auto distance = [](const NodePtr&, const NodePtr& cur, const NodePtr& next) {
+        return bg::distance(cur->position, next->position);
+    };
+    EXPECT_EQ(Landmarks(compact_graph, 10, distance).getLandmarks().size(), 6u);
+    Landmarks landmarks(compact_graph, 2, distance);
+    ASSERT_EQ(landmarks.getLandmarks().size(), 2u);
+    EXPECT_NE(landmarks.getLandmarks()[0], landmarks.getLandmarks()[1]);
+    // an end of the line is always picked, which makes bounds along the line exact
+    for (auto& from : nodes) {
+        for (auto& to : nodes) {
+            auto bound = landmarks.lowerBound(compact_graph->findIndex(from.get()), compact_graph->findIndex(to.get()));
+            EXPECT_FLOAT_EQ(bound, bg::distance(from->position, to->position));
+        }
+    }
+    // bounds stay finite towards unreachable nodes, and below the travel time over one way edges
+    auto outside_index = compact_graph->findIndex(outside.get());
+    EXPECT_LT(landmarks.lowerBound(compact_graph->findIndex(nodes[4].get()), outside_index), FLT_MAX);
+    EXPECT_LE(landmarks.lowerBound(outside_index, compact_graph->findIndex(nodes[4].get())), 5);
+    // the first landmark is the node farthest from the first node of the compact graph
+    Graph line;
+    make_pathway(line, nodes, {0, 0}, {4, 0}, 5);
+    auto compact_line = line.freeze();
+    auto& start = compact_line->getNode(0);
+    auto& first = compact_line->getNode(Landmarks(compact_line, 1, distance).getLandmarks()[0]);
+    for (auto& node : nodes) {
+        EXPECT_LE(bg::distance(start->position, node->position), bg::distance(start->position, first->position));
+    }
+}
+
+TEST(graph, landmarks_disconnected) {
+    Graph graph;
+    Nodes line, column, row;
+    make_pathway(graph, line, {0, 0}, {4, 0}, 5);
+    // a separate corner with a one way shortcut from its end back to its start, and a node without edges
+    make_pathway(graph, column, {10, 0}, {10, 4}, 5);
+    make_pathway(graph, row, {11, 4}, {14, 4}, 4);
+    column.back()->edges.push_back(row.front());
+    row.front()->edges.push_back(column.back());
+    row.back()->edges.push_back(column.front());
+    ASSERT_TRUE(graph.insertNode({20, 20}));
+    auto distance = [](const NodePtr&, const NodePtr& cur, const NodePtr& next) {
+        return bg::distance(cur->position, next->position);
+    };
+    auto compact_graph = graph.freeze();
+    // true travel times between all nodes, unreachable ones stay at FLT_MAX
+    size_t size = compact_graph->size();
+    std::vector<std::vector<float>> travel_times(size, std::vector<float>(size, FLT_MAX));
+    for (CompactGraph::Index from = 0; from < size; ++from) {
+        travel_times[from][from] = 0;
+        auto edges = compact_graph->getEdges(from);
+        for (auto to = edges.begin(); to != edges.end(); ++to) {
+            travel_times[from][to.index()] = distance(nullptr, compact_graph->getNode(from), *to);
+        }
+    }
+    for (size_t via = 0; via < size; ++via) {
+        for (size_t from = 0; from < size; ++from) {
+            for (size_t to = 0; to < size; ++to) {
+                if (travel_times[from][via] < FLT_MAX && travel_times[via][to] < FLT_MAX) {
+                    float travel_time = travel_times[from][via] + travel_times[via][to];
+                    travel_times[from][to] = std::min(travel_times[from][to], travel_time);
+                }
+            }
+        }
+    }
+    // bounds never exceed travel times, whichever components the landmarks end up in
+    for (size_t count = 1; count <= size; ++count) {
+        Landmarks landmarks(compact_graph, count, distance);
+        for (CompactGraph::Index from = 0; from < size; ++from) {
+            for (CompactGraph::Index to = 0; to < size; ++to) {
+                auto bound = landmarks.lowerBound(from, to);
+                EXPECT_GE(bound, 0);
+                EXPECT_LE(bound, travel_times[from][to] + 1e-4f) << count << " landmarks from " << from << " to " << to;
+            }
+        }
+    }
+}
+
+TEST(graph, save_load) {
+    auto file = testing::TempDir() + "graph_save_load.bin";
+    Graph graph;
+    Nodes nodes;
+    make_pathway(graph, nodes, {0, 0}, {9, 9}, 10);
+    nodes[3]->state = Node::NO_PARKING;
+    nodes[4]->state = Node::DISABLED;
+    // edges to nodes outside of the graph are not saved
+    nodes[5]->edges.emplace_back(new Node{{-1, -1}});
+    ASSERT_TRUE(graph.save(file.c_str()));
+    Graph loaded;
+    ASSERT_TRUE(loaded.insertNode(Point{100, 100}));
+    ASSERT_TRUE(loaded.load(file.c_str()));
+    ASSERT_EQ(loaded.getNodes().size(), nodes.size());
+    EXPECT_FALSE(loaded.findNode({100, 100}));
+    for (auto& node : nodes) {
+        auto& loaded_node = loaded.findNode(node->position);
+        ASSERT_TRUE(loaded_node);
+        EXPECT_EQ(loaded_node->state, node->state);
+        ASSERT_EQ(loaded_node->edges.size(), node == nodes[5] ? node->edges.size() - 1 : node->edges.size());
+        for (size_t i = 0; i < loaded_node->edges.size(); ++i) {
+            EXPECT_EQ(loaded_node->edges[i], loaded.findNode(node->edges[i]->position));
+        }
+    }
+    // empty graphs round trip
+    ASSERT_TRUE(Graph().save(file.c_str()));
+    ASSERT_TRUE(loaded.load(file.c_str()));
+    EXPECT_TRUE(loaded.getNodes().empty());
+    // reject missing and truncated files without modifying the graph
+    ASSERT_TRUE(graph.save(file.c_str()));
+    ASSERT_TRUE(truncate(file.c_str(), 30) == 0);
+    EXPECT_FALSE(graph.load(file.c_str()));
+    EXPECT_FALSE(graph.load((file + ".missing").c_str()));
+    EXPECT_EQ(graph.getNodes().size(), nodes.size());
+    remove(file.c_str());
+}
+
+TEST(graph, load_duplicate_positions) {
+    auto file = testing::TempDir() + "graph_load_duplicate_positions.bin";
+    Graph graph;
+    Nodes nodes;
+    make_pathway(graph, nodes, {0, 0}, {2, 0}, 3);
+    ASSERT_TRUE(graph.save(file.c_str()));
+    // overwrite the position of the second node in the file with the position of the first
+    auto fp = fopen(file.c_str(), "r+b");
+    ASSERT_TRUE(fp);
+    float position[DPA_NDIM];
+    long positions_offset = 5 * sizeof(uint32_t);
+    EXPECT_EQ(fseek(fp, positions_offset, SEEK_SET), 0);
+    EXPECT_EQ(fread(position, sizeof(position), 1, fp), 1u);
+    EXPECT_EQ(fseek(fp, positions_offset + sizeof(position), SEEK_SET), 0);
+    EXPECT_EQ(fwrite(position, sizeof(position), 1, fp), 1u);
+    ASSERT_EQ(fclose(fp), 0);
+    // a rejected file leaves the nodes of the graph untouched
+    Graph populated;
+    Nodes populated_nodes;
+    make_pathway(populated, populated_nodes, {0, 0}, {9, 9}, 10);
+    EXPECT_FALSE(populated.load(file.c_str()));
+    EXPECT_EQ(populated.getNodes().size(), populated_nodes.size());
+    for (size_t i = 0; i < populated_nodes.size(); ++i) {
+        auto& node = populated_nodes[i];
+        EXPECT_EQ(populated.findNode(node->position), node);
+        EXPECT_EQ(node->state, Node::DEFAULT);
+        EXPECT_EQ(node->edges.size(), i == 0 || i + 1 == populated_nodes.size() ? 1u : 2u);
+    }
+    remove(file.c_str());
+}
+
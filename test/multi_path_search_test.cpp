@@ -1,6 +1,7 @@
 #include <decentralized_path_auction/path_search.hpp>
 #include <decentralized_path_auction/path_sync.hpp>
 #include <gtest/gtest.h>
+#include <thread>
 
 using namespace decentralized_path_auction;
 
@@ -18,8 +19,8 @@ std::vector<Nodes> make_test_graph(Graph& graph);
 void print_path(const Path& path) {
     for (auto& visit : path) {
         printf("{[%.2f %.2f], t: %.2f, d: %.2e, p: %.2f, b: %.2f c:%.2f}\r\n", visit.node->position.get<0>(),
-                visit.node->position.get<1>(), visit.time_estimate, visit.duration, visit.price, visit.base_price,
-                visit.cost_estimate);
+                visit.node->position.get<1>(), visit.time_estimate, visit.duration, static_cast<float>(visit.price),
+                static_cast<float>(visit.base_price), visit.cost_estimate);
     }
     puts("");
 }
@@ -34,8 +35,9 @@ bool save_paths(const PathSync& path_sync, const char* file) {
     for (auto& info : path_sync.getPaths()) {
         for (auto& visit : info.second.path) {
             auto& bids = visit.node->auction.getBids();
-            fprintf(fp, "\"%s\", %d, %f, %f, %f, %lu\r\n", info.first.c_str(), i, visit.node->position.get<0>(),
-                    visit.node->position.get<1>(), visit.price, std::distance(bids.find(visit.price), bids.end()) - 1);
+            fprintf(fp, "\"%s\", %d, %f, %f, %f, %lu\r\n", info.first.name().c_str(), i, visit.node->position.get<0>(),
+                    visit.node->position.get<1>(), static_cast<float>(visit.price),
+                    std::distance(bids.find(visit.price), bids.end()) - 1);
         }
         ++i;
     }
@@ -57,7 +59,7 @@ struct Agent {
         path_search.setDestinations(std::move(dst), dst_dur);
     }
 
-    const std::string& id() { return path_search.getConfig().agent_id; }
+    AgentId id() { return path_search.getConfig().agent_id; }
 };
 
 void multi_iterate(std::vector<Agent>& agents, int rounds, size_t iterations, bool allow_block, bool print = false) {
@@ -67,7 +69,7 @@ void multi_iterate(std::vector<Agent>& agents, int rounds, size_t iterations, bo
             auto search_error = agent.path_search.iterate(agent.path, iterations, agent.fallback_cost);
             ASSERT_LE(search_error, PathSearch::ITERATIONS_REACHED);
             if (print) {
-                printf("%s error %d\r\n", agent.id().c_str(), search_error);
+                printf("%s error %d\r\n", agent.id().name().c_str(), search_error);
                 print_path(agent.path);
             }
             auto update_error = path_sync.updatePath(agent.id(), agent.path, agent.path_id++);
@@ -693,7 +695,8 @@ TEST(multi_path_search, push_line) {
                 Agent({"F"}, {nodes[0][5]}, {}),
                 Agent({"G", FLT_MAX, 10}, {nodes[0][6]}, {nodes[1][0]}),
         };
-        multi_iterate(agents, 200, 10000, false);
+        // how fast agents settle depends on which bid ids learned cost estimates end up under, so allow plenty of rounds
+        multi_iterate(agents, 2500, 10000, false);
         for (auto& agent : agents) {
             ASSERT_GT(agent.path.back().node->position.get<1>(), 0);
         }
@@ -748,3 +751,50 @@ TEST(multi_path_search, blocking_fallback) {
         ASSERT_EQ(agents.back().path.size(), 1);
     }
 }
+
+TEST(multi_path_search, concurrent_agents) {
+    // agents search and update their paths on separate threads
+    Graph graph;
+    auto nodes = make_test_graph(graph);
+    std::vector<Agent> agents = {
+            Agent({"A"}, {nodes[0][0]}, {nodes[0][9]}),
+            Agent({"B"}, {nodes[1][9]}, {nodes[1][1]}),
+            Agent({"C"}, {nodes[2][9]}, {nodes[2][1]}),
+            Agent({"D"}, {nodes[1][0]}, {nodes[2][0]}),
+    };
+    // searches share the mutex of the path sync to read the auctions while it updates them
+    auto mutex = std::make_shared<Auction::Mutex>();
+    for (auto& agent : agents) {
+        agent.path_search.getConfig().auction_mutex = mutex;
+    }
+    {
+        PathSync path_sync(mutex);
+        std::vector<std::thread> threads;
+        for (auto& agent : agents) {
+            threads.emplace_back([&agent, &path_sync]() {
+                for (int round = 0; round < 100; ++round) {
+                    auto search_error = agent.path_search.iterate(agent.path, 1000, agent.fallback_cost);
+                    EXPECT_LE(search_error, PathSearch::ITERATIONS_REACHED);
+                    // searches that yielded to writers carry on with the iterations left
+                    if (search_error == PathSearch::ITERATIONS_REACHED) {
+                        EXPECT_GE(agent.path_search.getIterationCount(), 1000u);
+                    }
+                    // updates may be rejected when other agents changed the auctions since the search
+                    path_sync.updatePath(agent.id(), agent.path, agent.path_id++);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        // committed paths keep their bids
+        for (auto& [agent_id, info] : path_sync.getPaths()) {
+            EXPECT_NE(path_sync.checkWaitStatus(agent_id).error, PathSync::VISIT_BID_ALREADY_REMOVED);
+        }
+    }
+    // searches resume from the paths they were left with
+    multi_iterate(agents, 100, 10000, true);
+    for (auto& agent : agents) {
+        ASSERT_EQ(agent.path.back().node, agent.path_search.getDestinations().getNodes().begin()->second);
+    }
+}
@@ -1,5 +1,6 @@
-#include <decentralized_path_auction/path_search.hpp>
+#include <decentralized_path_auction/path_search_impl.hpp>
 #include <gtest/gtest.h>
+#include <thread>
 
 using namespace decentralized_path_auction;
 
@@ -28,6 +29,40 @@ std::vector<Nodes> make_test_graph(Graph& graph) {
     return rows;
 }
 
+struct ComparedPaths {
+    Path path;
+    Path config_path;
+    size_t iterations;
+    size_t config_iterations;
+};
+
+// searches the test graph from the end of the first row to the end of the last row one iteration at a time, with the
+// default config and with the given one, and expects both searches to find paths through the same nodes
+template <class TravelTimeFn = TravelTime>
+ComparedPaths compare_paths(const std::vector<Nodes>& nodes, typename BasicPathSearch<TravelTimeFn>::Config config) {
+    using ConfigPathSearch = BasicPathSearch<TravelTimeFn>;
+    PathSearch path_search({"A"});
+    ConfigPathSearch config_path_search(std::move(config));
+    EXPECT_EQ(path_search.setDestinations({nodes[2][9]}), PathSearch::SUCCESS);
+    EXPECT_EQ(config_path_search.setDestinations({nodes[2][9]}), ConfigPathSearch::SUCCESS);
+    ComparedPaths paths = {{{nodes[0][9]}}, {{nodes[0][9]}}, 0, 0};
+    PathSearch::Error error;
+    while ((error = path_search.iterate(paths.path, 1)) == PathSearch::ITERATIONS_REACHED) {
+        ++paths.iterations;
+    }
+    EXPECT_EQ(error, PathSearch::SUCCESS);
+    typename ConfigPathSearch::Error config_error;
+    while ((config_error = config_path_search.iterate(paths.config_path, 1)) == ConfigPathSearch::ITERATIONS_REACHED) {
+        ++paths.config_iterations;
+    }
+    EXPECT_EQ(config_error, ConfigPathSearch::SUCCESS);
+    EXPECT_EQ(paths.path.size(), paths.config_path.size());
+    for (size_t i = 0; i < std::min(paths.path.size(), paths.config_path.size()); ++i) {
+        EXPECT_EQ(paths.path[i].node, paths.config_path[i].node);
+    }
+    return paths;
+}
+
 TEST(single_path_search, set_destinations_input_checks) {
     PathSearch path_search({"A"});
     NodePtr node(new Node{{0, 0}});
@@ -54,7 +89,7 @@ TEST(single_path_search, iterate_input_checks) {
     // config validation
     auto& config = path_search.getConfig();
 
-    config.agent_id.clear();
+    config.agent_id = {};
     EXPECT_EQ(path_search.iterate(path), PathSearch::CONFIG_AGENT_ID_EMPTY);
     config.agent_id = "A";
 
@@ -70,6 +105,10 @@ TEST(single_path_search, iterate_input_checks) {
     EXPECT_EQ(path_search.iterate(path), PathSearch::CONFIG_TRAVEL_TIME_MISSING);
     config.travel_time = PathSearch::travelDistance;
 
+    config.precompute_cost_estimates = true;
+    EXPECT_EQ(path_search.iterate(path), PathSearch::CONFIG_COMPACT_GRAPH_MISSING);
+    config.precompute_cost_estimates = false;
+
     // check source node
     path.clear();
     EXPECT_EQ(path_search.iterate(path), PathSearch::SOURCE_NODE_NOT_PROVIDED);
@@ -172,6 +211,143 @@ TEST(single_path_search, manual_iterations) {
     EXPECT_EQ(path.back().node, nodes[1][5]);
 }
 
+TEST(single_path_search, deadline_iterations) {
+    Graph graph;
+    auto nodes = make_test_graph(graph);
+    PathSearch path_search({"A"});
+    ASSERT_EQ(path_search.setDestinations({nodes[2][5]}), PathSearch::SUCCESS);
+    // only the first pass runs once the deadline has passed or stop is set
+    Path path = {{nodes[0][5]}};
+    EXPECT_EQ(path_search.iterate(path, PathSearch::Clock::now()), PathSearch::ITERATIONS_REACHED);
+    EXPECT_EQ(path_search.getIterationCount(), 0u);
+    EXPECT_GT(path.size(), 1u);
+    std::atomic<bool> stop = true;
+    auto deadline = PathSearch::Clock::now() + std::chrono::seconds(10);
+    EXPECT_EQ(path_search.iterate(path, deadline, &stop), PathSearch::ITERATIONS_REACHED);
+    EXPECT_EQ(path_search.getIterationCount(), 0u);
+    // iterations continue until the path is found before the deadline
+    stop = false;
+    EXPECT_EQ(path_search.iterate(path, deadline, &stop), PathSearch::SUCCESS);
+    EXPECT_GT(path_search.getIterationCount(), 0u);
+    EXPECT_EQ(path.back().node, nodes[2][5]);
+    // iteration counts are reported for iteration budgets as well
+    path = {{nodes[0][9]}};
+    EXPECT_EQ(path_search.iterate(path, 3), PathSearch::ITERATIONS_REACHED);
+    EXPECT_EQ(path_search.getIterationCount(), 3u);
+}
+
+TEST(single_path_search, pruned_bids) {
+    Graph graph;
+    auto nodes = make_test_graph(graph);
+    PathSearch path_search({"A"});
+    ASSERT_EQ(path_search.setDestinations({nodes[0][9]}), PathSearch::SUCCESS);
+    // bids of B are too expensive to beat the two lower bids in each auction
+    for (auto& node : nodes[0]) {
+        for (Price price : {1000, 2000}) {
+            Auction::Bid* prev = nullptr;
+            ASSERT_EQ(node->auction.insertBid("B", price, 0, prev), Auction::SUCCESS);
+        }
+    }
+    Path path = {{nodes[0][0]}};
+    EXPECT_EQ(path_search.iterate(path, 1000), PathSearch::SUCCESS);
+    EXPECT_GT(path_search.getPrunedCount(), 0u);
+    ASSERT_EQ(path.size(), 10u);
+    // only the source visit has to outbid B
+    EXPECT_GT(path.front().price, 2000);
+    for (size_t i = 1; i < path.size(); ++i) {
+        EXPECT_LT(path[i].price, 1000);
+    }
+}
+
+TEST(single_path_search, pruned_bids_count) {
+    Graph graph;
+    Nodes nodes;
+    make_pathway(graph, nodes, {0, 0}, {20, 0}, 3);
+    PathSearch path_search({"A"});
+    ASSERT_EQ(path_search.setDestinations({nodes[2]}), PathSearch::SUCCESS);
+    for (Price price : {1000, 2000, 3000}) {
+        Auction::Bid* prev = nullptr;
+        ASSERT_EQ(nodes[1]->auction.insertBid("B", price, 0, prev), Auction::SUCCESS);
+    }
+    // the first pass only evaluates the source, where every bid above the two lowest can't beat the second best cost
+    Path path = {{nodes[0]}};
+    EXPECT_EQ(path_search.iterate(path), PathSearch::PATH_EXTENDED);
+    EXPECT_EQ(path_search.getPrunedCount(), 2u);
+    ASSERT_EQ(path.size(), 2u);
+    EXPECT_EQ(path[1].base_price, 0);
+}
+
+TEST(single_path_search, incremental_replanning) {
+    Graph graph;
+    auto nodes = make_test_graph(graph);
+    PathSearch::Config config{"A"};
+    config.incremental_replanning = true;
+    PathSearch path_search(config);
+    ASSERT_EQ(path_search.setDestinations({nodes[0][9]}), PathSearch::SUCCESS);
+    Path path = {{nodes[2][9]}};
+    ASSERT_EQ(path_search.iterate(path, 1000), PathSearch::SUCCESS);
+    // the path stands as is when nothing changed
+    auto found_path = path;
+    EXPECT_EQ(path_search.iterate(path, 1000), PathSearch::SUCCESS);
+    EXPECT_EQ(path_search.getIterationCount(), 0u);
+    EXPECT_EQ(path.front().price, found_path.front().price);
+    // bids anywhere get it searched again, as bids far from the path may hold up bids around it
+    Auction::Bid* prev = nullptr;
+    ASSERT_EQ(nodes[1][9]->auction.insertBid("B", 1, 0, prev), Auction::SUCCESS);
+    EXPECT_EQ(path_search.iterate(path, 1000), PathSearch::SUCCESS);
+    EXPECT_NE(path.front().price, found_path.front().price);
+    found_path = path;
+    prev = nullptr;
+    ASSERT_EQ(nodes[0][5]->auction.insertBid("B", 1, 0, prev), Auction::SUCCESS);
+    EXPECT_EQ(path_search.iterate(path, 1000), PathSearch::SUCCESS);
+    ASSERT_EQ(path.size(), found_path.size());
+    ASSERT_EQ(path[16].node, nodes[0][5]);
+    EXPECT_NE(path[16].price, found_path[16].price);
+    EXPECT_NE(path.front().price, found_path.front().price);
+    // so do node states changes along the path
+    nodes[0][3]->state = Node::DISABLED;
+    EXPECT_EQ(path_search.iterate(path, 1000), PathSearch::ITERATIONS_REACHED);
+    nodes[0][3]->state = Node::DEFAULT;
+    EXPECT_EQ(path_search.iterate(path, 1000), PathSearch::SUCCESS);
+    EXPECT_EQ(path.back().node, nodes[0][9]);
+    // a different path is searched again in full
+    found_path = path;
+    path.pop_back();
+    EXPECT_EQ(path_search.iterate(path, 1000), PathSearch::SUCCESS);
+    EXPECT_EQ(path.back().node, nodes[0][9]);
+}
+
+TEST(single_path_search, incremental_replanning_linked_bids) {
+    Graph graph;
+    auto nodes = make_test_graph(graph);
+    PathSearch::Config config{"A"};
+    config.incremental_replanning = true;
+    PathSearch path_search(config);
+    config.incremental_replanning = false;
+    PathSearch full_path_search(config);
+    ASSERT_EQ(path_search.setDestinations({nodes[0][9]}), PathSearch::SUCCESS);
+    ASSERT_EQ(full_path_search.setDestinations({nodes[0][9]}), PathSearch::SUCCESS);
+    // bid around the path, linked from a bid further away
+    Auction::Bid* prev = nullptr;
+    ASSERT_EQ(nodes[1][5]->auction.insertBid("B", 1, 0, prev), Auction::SUCCESS);
+    ASSERT_EQ(nodes[0][5]->auction.insertBid("B", 1, 0, prev), Auction::SUCCESS);
+    Path path = {{nodes[2][9]}};
+    ASSERT_EQ(path_search.iterate(path, 1000), PathSearch::SUCCESS);
+    auto found_path = path;
+    // a bid that makes the linked bid wait longer holds up the bid around the path, without changing its auction
+    prev = nullptr;
+    ASSERT_EQ(nodes[1][5]->auction.insertBid("C", 2, 1000, prev), Auction::SUCCESS);
+    EXPECT_EQ(path_search.iterate(path, 1000), PathSearch::SUCCESS);
+    Path full_path = {{nodes[2][9]}};
+    ASSERT_EQ(full_path_search.iterate(full_path, 1000), PathSearch::SUCCESS);
+    // the path is searched again instead of returning the one found before
+    ASSERT_EQ(path.size(), full_path.size());
+    ASSERT_EQ(path[16].node, nodes[0][5]);
+    EXPECT_NE(path[16].base_price, found_path[16].base_price);
+    EXPECT_EQ(path[16].base_price, full_path[16].base_price);
+    EXPECT_FLOAT_EQ(path.front().cost_estimate, full_path.front().cost_estimate);
+}
+
 TEST(single_path_search, passive_path_manual_iterations) {
     Graph graph;
     auto nodes = make_test_graph(graph);
@@ -375,3 +551,216 @@ TEST(single_path_search, directional_edge) {
     ASSERT_EQ(path.size(), 1u);
     ASSERT_EQ(path.back().node, nodes[1]);
 }
+
+TEST(single_path_search, compact_graph) {
+    Graph graph;
+    auto nodes = make_test_graph(graph);
+    PathSearch::Config config{"B"};
+    config.compact_graph = graph.freeze();
+    compare_paths(nodes, config);
+    // adjacent nodes are read from the compact graph, so edges changed since it was frozen are not followed
+    PathSearch path_search(config);
+    ASSERT_EQ(path_search.setDestinations({nodes[2][9]}), PathSearch::SUCCESS);
+    nodes[1][0]->edges.clear();
+    Path path = {{nodes[0][9]}};
+    EXPECT_EQ(path_search.iterate(path, 1000), PathSearch::SUCCESS);
+    EXPECT_EQ(path.back().node, nodes[2][9]);
+    // node states are still respected
+    nodes[2][5]->state = Node::DISABLED;
+    path = {{nodes[0][9]}};
+    EXPECT_EQ(path_search.iterate(path, 1000), PathSearch::ITERATIONS_REACHED);
+}
+
+TEST(single_path_search, compact_graph_travel_times) {
+    Graph graph;
+    auto nodes = make_test_graph(graph);
+    PathSearch::Config config{"B"};
+    config.compact_graph = graph.freeze(PathSearch::travelDistance);
+    auto paths = compare_paths(nodes, config);
+    for (size_t i = 0; i < paths.path.size() && i < paths.config_path.size(); ++i) {
+        EXPECT_EQ(paths.path[i].duration, paths.config_path[i].duration);
+    }
+    // travel times are read from the cache instead of the config, until they are updated for a node
+    auto travel_time = [](const NodePtr&, const NodePtr& cur, const NodePtr& next) {
+        float scale = cur->state == Node::NO_PARKING ? 2 : 1;
+        return scale * bg::distance(cur->position, next->position);
+    };
+    auto compact_graph = graph.freeze(travel_time);
+    config.compact_graph = compact_graph;
+    config.travel_time = travel_time;
+    PathSearch path_search(config);
+    ASSERT_EQ(path_search.setDestinations({nodes[2][9]}), PathSearch::SUCCESS);
+    nodes[0][5]->state = Node::NO_PARKING;
+    Path path = {{nodes[0][9]}};
+    ASSERT_EQ(path_search.iterate(path, 1000), PathSearch::SUCCESS);
+    ASSERT_EQ(path[4].node, nodes[0][5]);
+    EXPECT_EQ(path[4].duration, 10);
+    compact_graph->updateTravelTimes(nodes[0][5].get());
+    path = {{nodes[0][9]}};
+    ASSERT_EQ(path_search.iterate(path, 1000), PathSearch::SUCCESS);
+    ASSERT_EQ(path[4].node, nodes[0][5]);
+    EXPECT_EQ(path[4].duration, 20);
+}
+
+TEST(single_path_search, precompute_cost_estimates) {
+    Graph graph;
+    auto nodes = make_test_graph(graph);
+    PathSearch::Config config{"B"};
+    config.compact_graph = graph.freeze();
+    config.precompute_cost_estimates = true;
+    // the exact estimates need fewer iterations to find the same path
+    auto paths = compare_paths(nodes, config);
+    EXPECT_LT(paths.config_iterations, paths.iterations);
+    // cost estimate of the source is the travel time along the aisles from the start
+    PathSearch path_search(config);
+    ASSERT_EQ(path_search.setDestinations({nodes[2][9]}), PathSearch::SUCCESS);
+    Path path = {{nodes[0][9]}};
+    EXPECT_EQ(path_search.iterate(path), PathSearch::PATH_EXTENDED);
+    EXPECT_FLOAT_EQ(path[0].cost_estimate, 200);
+    // disabled nodes are avoided by the backward search
+    nodes[1][0]->state = Node::DISABLED;
+    ASSERT_EQ(path_search.setDestinations({nodes[2][9]}), PathSearch::SUCCESS);
+    path = {{nodes[0][9]}};
+    EXPECT_EQ(path_search.iterate(path), PathSearch::PATH_EXTENDED);
+    EXPECT_FLOAT_EQ(path[0].cost_estimate, 10 + bg::distance(nodes[0][8]->position, nodes[2][9]->position));
+    // precomputed travel times only raise estimates of adjacent nodes, and never lower them below direct travel times
+    nodes[1][0]->state = Node::DEFAULT;
+    config.travel_time = [](const NodePtr&, const NodePtr& cur, const NodePtr& next) {
+        return static_cast<float>(bg::comparable_distance(cur->position, next->position));
+    };
+    PathSearch squared_search(config);
+    ASSERT_EQ(squared_search.setDestinations({nodes[0][9]}), PathSearch::SUCCESS);
+    path = {{nodes[0][0]}};
+    EXPECT_EQ(squared_search.iterate(path), PathSearch::PATH_EXTENDED);
+    EXPECT_FLOAT_EQ(path[0].cost_estimate, 10 * 10 + 80 * 80);
+    ASSERT_EQ(squared_search.setDestinations({nodes[2][9]}), PathSearch::SUCCESS);
+    path = {{nodes[0][9]}};
+    EXPECT_EQ(squared_search.iterate(path), PathSearch::PATH_EXTENDED);
+    EXPECT_FLOAT_EQ(path[0].cost_estimate, 10 * 10 + 19 * 10 * 10);
+}
+
+TEST(single_path_search, cost_estimate_tables) {
+    Graph graph;
+    auto nodes = make_test_graph(graph);
+    PathSearch::Config config{"A"};
+    auto compact_graph = graph.freeze();
+    config.compact_graph = compact_graph;
+    config.precompute_cost_estimates = true;
+    config.cost_estimate_tables = std::make_shared<CostEstimateTables>();
+    PathSearch path_search_a(config);
+    config.agent_id = "B";
+    PathSearch path_search_b(config);
+    // searches with the same destinations share a table regardless of destination order
+    ASSERT_EQ(path_search_a.setDestinations({nodes[2][9], nodes[1][9]}), PathSearch::SUCCESS);
+    ASSERT_EQ(path_search_b.setDestinations({nodes[1][9], nodes[2][9]}), PathSearch::SUCCESS);
+    EXPECT_EQ(config.cost_estimate_tables->size(), 1u);
+    ASSERT_EQ(path_search_b.setDestinations({nodes[2][9]}), PathSearch::SUCCESS);
+    EXPECT_EQ(config.cost_estimate_tables->size(), 2u);
+    // shared tables give the same estimates as owned ones
+    Path path = {{nodes[0][9]}};
+    EXPECT_EQ(path_search_b.iterate(path), PathSearch::PATH_EXTENDED);
+    EXPECT_FLOAT_EQ(path[0].cost_estimate, 200);
+    // tables are not shared across updates to node states
+    nodes[1][0]->state = Node::DISABLED;
+    compact_graph->updateTravelTimes(nodes[1][0].get());
+    ASSERT_EQ(path_search_a.setDestinations({nodes[2][9]}), PathSearch::SUCCESS);
+    EXPECT_EQ(config.cost_estimate_tables->size(), 2u);
+    path = {{nodes[0][9]}};
+    EXPECT_EQ(path_search_a.iterate(path), PathSearch::PATH_EXTENDED);
+    EXPECT_LT(path[0].cost_estimate, 200);
+    // nor across changes to destination states
+    nodes[1][0]->state = Node::DEFAULT;
+    compact_graph->updateTravelTimes(nodes[1][0].get());
+    nodes[2][9]->state = Node::NO_FALLBACK;
+    ASSERT_EQ(path_search_a.setDestinations({nodes[2][9]}), PathSearch::SUCCESS);
+    EXPECT_EQ(config.cost_estimate_tables->size(), 2u);
+    nodes[2][9]->state = Node::DEFAULT;
+    ASSERT_EQ(path_search_a.setDestinations({nodes[2][9]}), PathSearch::SUCCESS);
+    EXPECT_EQ(config.cost_estimate_tables->size(), 2u);
+    path = {{nodes[0][9]}};
+    EXPECT_EQ(path_search_a.iterate(path), PathSearch::PATH_EXTENDED);
+    EXPECT_FLOAT_EQ(path[0].cost_estimate, 200);
+    // nor across travel time models
+    config.agent_id = "C";
+    config.travel_time = [](const NodePtr&, const NodePtr& cur, const NodePtr& next) {
+        return 2 * PathSearch::travelDistance(nullptr, cur, next);
+    };
+    PathSearch path_search_c(config);
+    ASSERT_EQ(path_search_c.setDestinations({nodes[2][9]}), PathSearch::SUCCESS);
+    EXPECT_EQ(config.cost_estimate_tables->size(), 3u);
+    path = {{nodes[0][9]}};
+    EXPECT_EQ(path_search_c.iterate(path), PathSearch::PATH_EXTENDED);
+    EXPECT_FLOAT_EQ(path[0].cost_estimate, 400);
+    ASSERT_EQ(path_search_c.setDestinations({}), PathSearch::SUCCESS);
+    // tables are dropped once no search holds them
+    ASSERT_EQ(path_search_a.setDestinations({}), PathSearch::SUCCESS);
+    ASSERT_EQ(path_search_b.setDestinations({}), PathSearch::SUCCESS);
+    EXPECT_EQ(config.cost_estimate_tables->size(), 0u);
+}
+
+TEST(single_path_search, cost_estimate_tables_threads) {
+    Graph graph;
+    auto nodes = make_test_graph(graph);
+    auto compact_graph = graph.freeze();
+    NodeRTree destinations;
+    destinations.insertNode(nodes[2][9]);
+    CostEstimateTables tables;
+    std::atomic<int> computed = 0;
+    // searches asking for a table while it is computed wait for it instead of computing it again
+    std::vector<std::shared_ptr<const CostEstimateTables::Table>> results(4);
+    std::vector<std::thread> threads;
+    for (auto& result : results) {
+        threads.emplace_back([&]() {
+            result = tables.getTable(compact_graph, destinations, {typeid(void), 0}, [&computed](auto& table) {
+                ++computed;
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                table.travel_times.assign(table.graph->size(), 0);
+            });
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(computed, 1);
+    for (auto& result : results) {
+        EXPECT_EQ(result, results.front());
+    }
+    EXPECT_EQ(tables.size(), 1u);
+}
+
+TEST(single_path_search, landmarks) {
+    Graph graph;
+    auto nodes = make_test_graph(graph);
+    PathSearch::Config config{"B"};
+    config.landmarks = std::make_shared<Landmarks>(graph.freeze(), 4, PathSearch::travelDistance);
+    // bounds much closer to the travel time along the aisles than straight lines need fewer iterations
+    auto paths = compare_paths(nodes, config);
+    EXPECT_LT(paths.config_iterations, paths.iterations);
+    PathSearch path_search(config);
+    ASSERT_EQ(path_search.setDestinations({nodes[2][9]}), PathSearch::SUCCESS);
+    Path path = {{nodes[0][9]}};
+    EXPECT_EQ(path_search.iterate(path), PathSearch::PATH_EXTENDED);
+    EXPECT_GT(path[0].cost_estimate, 100);
+    EXPECT_LE(path[0].cost_estimate, 200);
+}
+
+TEST(single_path_search, functor_travel_time) {
+    struct ScaledDistance {
+        float scale = 0;
+        float operator()(const NodePtr&, const NodePtr& cur, const NodePtr& next) const {
+            return scale * bg::distance(cur->position, next->position);
+        }
+    };
+    using FunctorPathSearch = BasicPathSearch<ScaledDistance>;
+    Graph graph;
+    auto nodes = make_test_graph(graph);
+    FunctorPathSearch::Config config{"B"};
+    // functors can't be checked for being set, so they are always valid
+    EXPECT_EQ(config.validate(), FunctorPathSearch::SUCCESS);
+    // the functor given is the one called, and finds the same path with travel times scaled
+    config.travel_time = {2};
+    auto paths = compare_paths<ScaledDistance>(nodes, config);
+    for (size_t i = 0; i + 1 < paths.path.size() && i + 1 < paths.config_path.size(); ++i) {
+        EXPECT_EQ(paths.config_path[i].duration, 2 * paths.path[i].duration);
+    }
+}